@@ -8,12 +8,12 @@ int main( int argc, char * argv[] )
   // we have to do more to see a difference
 
   int i = 0;
-  for( i = 0; i < 1000; i ++)
+  for( i = 0; i < 10000; i ++)
   {
     array[i] = mavalloc_alloc( 100 );
   }
 
-  for( i = 0; i < 1000; i ++)
+  for( i = 0; i < 10000; i ++)
   {
     mavalloc_free( array[i] );
   }
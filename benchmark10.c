@@ -0,0 +1,137 @@
+/**
+* benchmark10.c
+*
+* Copy-on-write snapshot cost.  For several arena sizes the arena is filled
+* with live blocks, then:
+*
+*   latency  - how long mavalloc_snapshot takes to return
+*   written  - how long the child takes to write the snapshot out
+*   mutator  - throughput of an alloc/free/write loop on its own and while a
+*              snapshot is being written, when every first write to a page
+*              has to copy it
+*
+* The last snapshot is reopened with mavalloc_open_persistent to check it.
+*
+*   gcc -O2 -o benchmark10 benchmark10.c mavalloc.c
+*   ./benchmark10 [snapshot file]
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "mavalloc.h"
+
+#define BLOCKS       4000
+#define MUTATOR_OPS  20000
+
+static const size_t arena_sizes[] = { 64 << 20, 256 << 20, 1024 << 20 };
+
+static void * blocks[BLOCKS];
+
+static unsigned int seed = 2463534242u;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Replace a random block and write one page of it, returns 0 on failure */
+static int mutate( size_t block_size )
+{
+  int slot = next_random( ) % BLOCKS;
+
+  mavalloc_free( blocks[slot] );
+  blocks[slot] = mavalloc_alloc( block_size );
+  if( blocks[slot] == NULL )
+  {
+    return 0;
+  }
+  memset( blocks[slot], slot & 0xff, 4096 );
+  return 1;
+}
+
+int main( int argc, char * argv[] )
+{
+  const char * path = argc > 1 ? argv[1] : "benchmark10.snapshot";
+  size_t block_size = 0;
+  unsigned int a;
+  int i;
+
+  printf( "%8s %12s %12s %14s %14s %9s\n", "arena MB", "latency ms", "written ms",
+          "alone Kops/s", "during Kops/s", "slowdown" );
+
+  for( a = 0; a < sizeof( arena_sizes ) / sizeof( arena_sizes[0] ); a++ )
+  {
+    double start, latency, written, alone, during;
+    long   ops = 0;
+    int    fd, snapshot, status;
+
+    /* Fill three quarters of the arena and touch every page */
+    block_size = arena_sizes[a] / BLOCKS * 3 / 4;
+    if( mavalloc_init( arena_sizes[a], FIRST_FIT ) != 0 )
+    {
+      printf( "%8zu could not allocate the arena\n", arena_sizes[a] >> 20 );
+      continue;
+    }
+    for( i = 0; i < BLOCKS; i++ )
+    {
+      blocks[i] = mavalloc_alloc( block_size );
+      memset( blocks[i], i & 0xff, block_size );
+    }
+
+    start = now_ms( );
+    for( i = 0; i < MUTATOR_OPS; i++ )
+    {
+      mutate( block_size );
+    }
+    alone = MUTATOR_OPS / ( now_ms( ) - start );
+
+    fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    start = now_ms( );
+    snapshot = mavalloc_snapshot( fd );
+    latency = now_ms( ) - start;
+
+    /* Keep mutating for as long as the snapshot is open */
+    while( waitpid( snapshot, &status, WNOHANG ) == 0 )
+    {
+      mutate( block_size );
+      ops++;
+    }
+    written = now_ms( ) - start;
+    during = ops / ( written - latency );
+    close( fd );
+
+    printf( "%8zu %12.3f %12.1f %14.1f %14.1f %8.2fx\n", arena_sizes[a] >> 20, latency,
+            written, alone, during, alone / during );
+
+    mavalloc_destroy( );
+  }
+
+  /* The snapshot is a persistent arena file holding every block */
+  if( mavalloc_open_persistent( path, 0, FIRST_FIT ) == 0 )
+  {
+    printf( "reopened snapshot: %d ledger nodes\n", mavalloc_size( ) );
+    mavalloc_destroy( );
+  }
+  else
+  {
+    printf( "could not reopen snapshot\n" );
+  }
+
+  unlink( path );
+  return 0;
+}
@@ -0,0 +1,258 @@
+/**
+* benchmark11.c
+*
+* Message passing between two processes through a shared arena against
+* copying the messages through a pipe.
+*
+*   pipe    - the producer fills a buffer and writes it to a pipe, the
+*             consumer reads it into its own buffer
+*   shared  - the producer allocates the message in a shared arena, fills it
+*             in place and writes only its offset to the pipe, the consumer
+*             reads the message where it is and frees it
+*
+* The consumer checks the first and last byte of every message and touches
+* one byte per cache line in between, so both sides do the same work apart
+* from the copy.
+*
+*   gcc -O2 -o benchmark11 benchmark11.c mavalloc.c -lpthread -lrt
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE   ( 64 * 1024 * 1024 )
+#define TOTAL_BYTES  ( 512L * 1024 * 1024 )
+#define MAX_MESSAGES 200000L
+
+#define END_OF_STREAM ( (size_t)-1 )
+
+static const size_t sizes[] = { 64, 4096, 65536, 1024 * 1024 };
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int read_all( int fd, void * data, size_t length )
+{
+  char * next = data;
+
+  while( length > 0 )
+  {
+    ssize_t got = read( fd, next, length );
+    if( got <= 0 )
+    {
+      return -1;
+    }
+    next += got;
+    length -= got;
+  }
+  return 0;
+}
+
+static int write_all( int fd, const void * data, size_t length )
+{
+  const char * next = data;
+
+  while( length > 0 )
+  {
+    ssize_t written = write( fd, next, length );
+    if( written <= 0 )
+    {
+      return -1;
+    }
+    next += written;
+    length -= written;
+  }
+  return 0;
+}
+
+/* Returns 0 if message number i arrived intact */
+static int consume( const unsigned char * message, size_t size, long i )
+{
+  unsigned int sum = 0;
+  size_t j;
+
+  for( j = 0; j < size; j += 64 )
+  {
+    sum += message[j];
+  }
+  return message[0] == (unsigned char)i && message[size - 1] == (unsigned char)i &&
+         sum == (unsigned int)(unsigned char)i * ( ( size + 63 ) / 64 ) ? 0 : -1;
+}
+
+static double run_pipe( size_t size, long messages )
+{
+  unsigned char * buffer = malloc( size );
+  int   fds[2];
+  pid_t consumer;
+  int   status;
+  long  i;
+  double start;
+
+  pipe( fds );
+  start = now_ms( );
+
+  consumer = fork( );
+  if( consumer == 0 )
+  {
+    close( fds[1] );
+    for( i = 0; i < messages; i++ )
+    {
+      if( read_all( fds[0], buffer, size ) != 0 || consume( buffer, size, i ) != 0 )
+      {
+        _exit( 1 );
+      }
+    }
+    _exit( 0 );
+  }
+
+  close( fds[0] );
+  for( i = 0; i < messages; i++ )
+  {
+    memset( buffer, (unsigned char)i, size );
+    write_all( fds[1], buffer, size );
+  }
+  close( fds[1] );
+  waitpid( consumer, &status, 0 );
+  free( buffer );
+
+  if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+  {
+    return -1.0;
+  }
+  return now_ms( ) - start;
+}
+
+static double run_shared( const char * name, size_t size, long messages )
+{
+  size_t offset;
+  int    fds[2];
+  pid_t  consumer;
+  int    status;
+  long   i;
+  double start;
+
+  /* Keep at most a page of offsets, 512 messages, in flight.  The default
+   * pipe lets thousands of blocks pile up in the ledger and every search
+   * walks them.
+   */
+  pipe( fds );
+  fcntl( fds[1], F_SETPIPE_SZ, 4096 );
+  start = now_ms( );
+
+  /* Each side opens the arena by name, whichever is first creates it */
+  consumer = fork( );
+  if( consumer == 0 )
+  {
+    close( fds[1] );
+    if( mavalloc_init_shared( name, ARENA_SIZE, FIRST_FIT ) != 0 )
+    {
+      _exit( 1 );
+    }
+    for( i = 0; ; i++ )
+    {
+      unsigned char * message;
+
+      if( read_all( fds[0], &offset, sizeof( offset ) ) != 0 )
+      {
+        _exit( 1 );
+      }
+      if( offset == END_OF_STREAM )
+      {
+        break;
+      }
+      message = mavalloc_from_offset( offset );
+      if( consume( message, size, i ) != 0 )
+      {
+        _exit( 1 );
+      }
+      mavalloc_free( message );
+    }
+    mavalloc_destroy( );
+    _exit( i == messages ? 0 : 1 );
+  }
+
+  close( fds[0] );
+  if( mavalloc_init_shared( name, ARENA_SIZE, FIRST_FIT ) != 0 )
+  {
+    close( fds[1] );
+    waitpid( consumer, &status, 0 );
+    return -1.0;
+  }
+  for( i = 0; i < messages; i++ )
+  {
+    unsigned char * message;
+
+    /* The arena is full until the consumer catches up */
+    while( ( message = mavalloc_alloc( size ) ) == NULL )
+    {
+      sched_yield( );
+    }
+    memset( message, (unsigned char)i, size );
+    offset = mavalloc_to_offset( message );
+    write_all( fds[1], &offset, sizeof( offset ) );
+  }
+  offset = END_OF_STREAM;
+  write_all( fds[1], &offset, sizeof( offset ) );
+  close( fds[1] );
+  waitpid( consumer, &status, 0 );
+
+  mavalloc_destroy( );
+  shm_unlink( name );
+
+  if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+  {
+    return -1.0;
+  }
+  return now_ms( ) - start;
+}
+
+int main( int argc, char * argv[] )
+{
+  char name[64];
+  unsigned int s;
+
+  snprintf( name, sizeof( name ), "/mavalloc-benchmark11-%d", (int)getpid( ) );
+  shm_unlink( name );
+
+  printf( "%10s %10s %14s %14s %14s %14s %8s\n", "size", "messages", "pipe msg/s",
+          "shared msg/s", "pipe MB/s", "shared MB/s", "speedup" );
+
+  for( s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); s++ )
+  {
+    long   messages = TOTAL_BYTES / sizes[s];
+    double piped, shared;
+
+    if( messages > MAX_MESSAGES )
+    {
+      messages = MAX_MESSAGES;
+    }
+
+    piped = run_pipe( sizes[s], messages );
+    shared = run_shared( name, sizes[s], messages );
+    if( piped < 0 || shared < 0 )
+    {
+      printf( "%10zu %10ld message lost or corrupted\n", sizes[s], messages );
+      continue;
+    }
+
+    printf( "%10zu %10ld %14.0f %14.0f %14.1f %14.1f %7.2fx\n", sizes[s], messages,
+            messages / piped * 1000.0, messages / shared * 1000.0,
+            messages * (double)sizes[s] / ( 1024 * 1024 ) / piped * 1000.0,
+            messages * (double)sizes[s] / ( 1024 * 1024 ) / shared * 1000.0,
+            piped / shared );
+  }
+  return 0;
+}
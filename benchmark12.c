@@ -0,0 +1,156 @@
+/**
+* benchmark12.c
+*
+* Huge blocks served outside the arena, with the threshold off and on.
+*
+*   growth  - a buffer grown with mavalloc_realloc from 1 MB to 256 MB, 25%
+*             at a time, writing the new tail after every step.  Inside the
+*             arena every step copies the whole buffer, a huge block is
+*             remapped.
+*   buffers - a churning set of small objects with a 64 MB buffer allocated
+*             and released every round.  Inside the arena the small objects
+*             drift into the space the buffer left and later buffers no
+*             longer fit.
+*
+*   gcc -O2 -o benchmark12 benchmark12.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mavalloc.h"
+
+#define GROWTH_ARENA    ( 1024L * 1024 * 1024 )
+#define GROWTH_START    ( 1024 * 1024 )
+#define GROWTH_END      ( 256 * 1024 * 1024 )
+
+#define BUFFER_ARENA    ( 96 * 1024 * 1024 )
+#define BUFFER_SIZE     ( 64 * 1024 * 1024 )
+#define ROUNDS          50
+#define SMALL_LIVE      4000
+#define SMALL_OPS       2000
+
+#define HUGE_THRESHOLD  ( 1024 * 1024 )
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT" };
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Returns the elapsed time, or -1 if the buffer could not be grown */
+static double growth( size_t threshold )
+{
+  size_t size = GROWTH_START;
+  unsigned char * buffer;
+  double start;
+
+  mavalloc_init( GROWTH_ARENA, FIRST_FIT );
+  mavalloc_set_huge_threshold( threshold );
+
+  start = now_ms( );
+  buffer = mavalloc_alloc( size );
+  memset( buffer, 1, size );
+
+  while( size < GROWTH_END )
+  {
+    size_t grown = size + size / 4;
+
+    buffer = mavalloc_realloc( buffer, grown );
+    if( buffer == NULL )
+    {
+      mavalloc_destroy( );
+      return -1.0;
+    }
+    memset( buffer + size, 1, grown - size );
+    size = grown;
+  }
+
+  double elapsed = now_ms( ) - start;
+  mavalloc_free( buffer );
+  mavalloc_destroy( );
+  return elapsed;
+}
+
+/* Returns how many of the large buffers could not be allocated */
+static int buffers( enum ALGORITHM algorithm, size_t threshold, int * nodes )
+{
+  static void * small[SMALL_LIVE];
+  int failures = 0;
+  int round, i;
+
+  seed = 2463534242u;
+  mavalloc_init( BUFFER_ARENA, algorithm );
+  mavalloc_set_huge_threshold( threshold );
+
+  for( i = 0; i < SMALL_LIVE; i++ )
+  {
+    small[i] = mavalloc_alloc( 64 + next_random( ) % 12288 );
+  }
+
+  for( round = 0; round < ROUNDS; round++ )
+  {
+    void * buffer = mavalloc_alloc( BUFFER_SIZE );
+
+    if( buffer == NULL )
+    {
+      failures++;
+    }
+
+    /* The buffer is released half way through the round */
+    for( i = 0; i < SMALL_OPS; i++ )
+    {
+      int slot = next_random( ) % SMALL_LIVE;
+
+      if( i == SMALL_OPS / 2 )
+      {
+        mavalloc_free( buffer );
+      }
+      mavalloc_free( small[slot] );
+      small[slot] = mavalloc_alloc( 64 + next_random( ) % 12288 );
+    }
+  }
+
+  *nodes = mavalloc_size( );
+  mavalloc_destroy( );
+  return failures;
+}
+
+int main( int argc, char * argv[] )
+{
+  double in_arena = growth( 0 );
+  double remapped = growth( HUGE_THRESHOLD );
+  int algorithm;
+
+  printf( "growth 1 MB -> 256 MB: in arena %.1f ms, remapped %.1f ms, %.1fx\n\n",
+          in_arena, remapped, in_arena / remapped );
+
+  printf( "%d rounds of one %d MB buffer among %d small objects\n", ROUNDS,
+          BUFFER_SIZE / ( 1024 * 1024 ), SMALL_LIVE );
+  printf( "%-10s %16s %14s %16s %14s\n", "algorithm", "in arena failed", "ledger nodes",
+          "mapped failed", "ledger nodes" );
+
+  for( algorithm = FIRST_FIT; algorithm <= WORST_FIT; algorithm++ )
+  {
+    int arena_nodes, mapped_nodes;
+    int arena_failures = buffers( algorithm, 0, &arena_nodes );
+    int mapped_failures = buffers( algorithm, HUGE_THRESHOLD, &mapped_nodes );
+
+    printf( "%-10s %16d %14d %16d %14d\n", names[algorithm], arena_failures, arena_nodes,
+            mapped_failures, mapped_nodes );
+  }
+  return 0;
+}
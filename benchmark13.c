@@ -0,0 +1,230 @@
+/**
+* benchmark13.c
+*
+* NUMA placement of the arena.  The benchmark pins itself to the CPU it
+* starts on and compares an arena bound to that CPU's node with one bound to
+* another node:
+*
+*   write  - allocate the blocks and fill them, which also faults the pages in
+*   read   - sum every block several times over
+*
+* It then starts one thread per online CPU, each attached with
+* mavalloc_init_thread to the arena of its node, and reports where each one
+* landed.  The threads of a node share its arena.  The blocks a thread still
+* holds when it is done are freed by the main thread afterwards, the way a
+* worker pool hands its results back.
+*
+* On a single node machine both runs use node 0, the numbers should match
+* and show what the benchmark measures without any remote traffic.
+*
+*   gcc -O2 -o benchmark13 benchmark13.c mavalloc.c -lpthread
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE    ( 320 * 1024 * 1024 )
+#define BLOCK_SIZE    ( 2 * 1024 * 1024 )
+#define BLOCKS        128
+#define READ_PASSES   4
+
+#define THREAD_ARENA  ( 16 * 1024 * 1024 )
+#define THREAD_OPS    200000
+#define MAX_THREADS   64
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Highest online node number, 0 if the kernel does not say */
+static int last_node( )
+{
+  FILE * file = fopen( "/sys/devices/system/node/online", "r" );
+  char   line[256];
+  char * last;
+  int    node = 0;
+
+  if( file == NULL )
+  {
+    return 0;
+  }
+  if( fgets( line, sizeof( line ), file ) != NULL )
+  {
+    last = strrchr( line, '-' );
+    if( last == NULL )
+    {
+      last = strrchr( line, ',' );
+    }
+    node = atoi( last != NULL ? last + 1 : line );
+  }
+  fclose( file );
+  return node;
+}
+
+static int node_of_cpu( int cpu )
+{
+  char path[128];
+  int  node;
+
+  for( node = 0; node <= last_node( ); node++ )
+  {
+    snprintf( path, sizeof( path ), "/sys/devices/system/node/node%d/cpu%d", node, cpu );
+    if( access( path, F_OK ) == 0 )
+    {
+      return node;
+    }
+  }
+  return 0;
+}
+
+static void bandwidth( const char * label, int node )
+{
+  static unsigned char * blocks[BLOCKS];
+  double start, write_ms, read_ms;
+  unsigned long sum = 0;
+  int i, pass;
+  size_t j;
+
+  if( mavalloc_init_numa( ARENA_SIZE, FIRST_FIT, node ) != 0 )
+  {
+    printf( "%-8s could not map the arena\n", label );
+    return;
+  }
+
+  start = now_ms( );
+  for( i = 0; i < BLOCKS; i++ )
+  {
+    blocks[i] = mavalloc_alloc( BLOCK_SIZE );
+    memset( blocks[i], i, BLOCK_SIZE );
+  }
+  write_ms = now_ms( ) - start;
+
+  start = now_ms( );
+  for( pass = 0; pass < READ_PASSES; pass++ )
+  {
+    for( i = 0; i < BLOCKS; i++ )
+    {
+      const unsigned long * words = (const unsigned long *)blocks[i];
+      for( j = 0; j < BLOCK_SIZE / sizeof( unsigned long ); j++ )
+      {
+        sum += words[j];
+      }
+    }
+  }
+  read_ms = now_ms( ) - start;
+
+  printf( "%-8s node %d  bound %-3s  write %7.2f GB/s  read %7.2f GB/s  (%lx)\n", label, node,
+          mavalloc_numa_node( ) == node ? "yes" : "no",
+          (double)BLOCKS * BLOCK_SIZE / write_ms / 1e6,
+          (double)BLOCKS * BLOCK_SIZE * READ_PASSES / read_ms / 1e6, sum & 0xff );
+
+  mavalloc_destroy( );
+}
+
+struct thread_result
+{
+  int    cpu;
+  int    node;
+  double ms;
+  void * live[256];
+};
+
+static void * thread_main( void * argument )
+{
+  struct thread_result * result = argument;
+  cpu_set_t set;
+  void ** live = result->live;
+  double start;
+  int i;
+
+  CPU_ZERO( &set );
+  CPU_SET( result->cpu, &set );
+  sched_setaffinity( 0, sizeof( set ), &set );
+
+  if( mavalloc_init_thread( THREAD_ARENA, FIRST_FIT ) != 0 )
+  {
+    result->ms = -1.0;
+    return NULL;
+  }
+  result->node = mavalloc_numa_node( );
+
+  start = now_ms( );
+  for( i = 0; i < THREAD_OPS; i++ )
+  {
+    int slot = ( i * 7919 ) % 256;
+
+    mavalloc_free( live[slot] );
+    live[slot] = mavalloc_alloc( 64 + ( i % 32 ) * 64 );
+    memset( live[slot], i, 64 );
+  }
+  result->ms = now_ms( ) - start;
+
+  mavalloc_destroy( );
+  return NULL;
+}
+
+int main( int argc, char * argv[] )
+{
+  struct thread_result results[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  int nodes = last_node( ) + 1;
+  int cpus = sysconf( _SC_NPROCESSORS_ONLN );
+  int cpu = sched_getcpu( );
+  int local, remote, i, j;
+  cpu_set_t set;
+
+  if( cpu < 0 )
+  {
+    cpu = 0;
+  }
+  CPU_ZERO( &set );
+  CPU_SET( cpu, &set );
+  sched_setaffinity( 0, sizeof( set ), &set );
+
+  local = node_of_cpu( cpu );
+  remote = ( local + 1 ) % nodes;
+
+  printf( "%d node(s), running on cpu %d of node %d\n", nodes, cpu, local );
+  if( nodes == 1 )
+  {
+    printf( "single node: the remote run uses the local node\n" );
+  }
+
+  bandwidth( "local", local );
+  bandwidth( "remote", remote );
+
+  if( cpus > MAX_THREADS )
+  {
+    cpus = MAX_THREADS;
+  }
+  for( i = 0; i < cpus; i++ )
+  {
+    results[i].cpu = i;
+    results[i].node = -1;
+    memset( results[i].live, 0, sizeof( results[i].live ) );
+    pthread_create( &threads[i], NULL, thread_main, &results[i] );
+  }
+  for( i = 0; i < cpus; i++ )
+  {
+    pthread_join( threads[i], NULL );
+    printf( "thread on cpu %2d: arena on node %2d, %.0f Kops/s\n", results[i].cpu,
+            results[i].node, THREAD_OPS / results[i].ms );
+
+    // every free goes back to the node arena the block came from
+    for( j = 0; j < 256; j++ )
+    {
+      mavalloc_free( results[i].live[j] );
+    }
+  }
+  return 0;
+}
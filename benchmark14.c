@@ -0,0 +1,148 @@
+/**
+* benchmark14.c
+*
+* Cost of the heap profiler.  The same churn of mixed size allocations from
+* three call sites runs with the profiler off and with it sampling every
+* 512 KB, 64 KB and 4 KB, then the profile of the last run is written to
+* benchmark14.heap for pprof:
+*
+*   pprof --text --inuse_space ./benchmark14 benchmark14.heap
+*
+* The file holds the raw samples, pprof scales them back up to estimates of
+* the real bytes, which the benchmark prints for comparison.
+*
+*   gcc -O2 -g -o benchmark14 benchmark14.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE  ( 64 * 1024 * 1024 )
+#define LIVE        1024
+#define OPS         200000
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Three distinct call sites with their own size ranges */
+static void * __attribute__(( noinline )) small_object( )
+{
+  return mavalloc_alloc( 16 + next_random( ) % 112 );
+}
+
+static void * __attribute__(( noinline )) medium_object( )
+{
+  return mavalloc_alloc( 512 + next_random( ) % 3584 );
+}
+
+static void * __attribute__(( noinline )) large_object( )
+{
+  return mavalloc_alloc( 16384 + next_random( ) % 16384 );
+}
+
+static double churn( size_t period, size_t live_bytes[3] )
+{
+  static void * live[LIVE];
+  static int site[LIVE];
+  double start;
+  int i;
+
+  seed = 2463534242u;
+  memset( live, 0, sizeof( live ) );
+  mavalloc_init( ARENA_SIZE, FIRST_FIT );
+  if( period != 0 )
+  {
+    mavalloc_profile_start( period );
+  }
+
+  start = now_ms( );
+  for( i = 0; i < OPS; i++ )
+  {
+    int slot = next_random( ) % LIVE;
+    int kind = next_random( ) % 16;
+
+    mavalloc_free( live[slot] );
+    if( kind < 12 )
+    {
+      live[slot] = small_object( );
+      site[slot] = 0;
+    }
+    else if( kind < 15 )
+    {
+      live[slot] = medium_object( );
+      site[slot] = 1;
+    }
+    else
+    {
+      live[slot] = large_object( );
+      site[slot] = 2;
+    }
+  }
+  double elapsed = now_ms( ) - start;
+
+  live_bytes[0] = live_bytes[1] = live_bytes[2] = 0;
+  for( i = 0; i < LIVE; i++ )
+  {
+    if( live[i] != NULL )
+    {
+      live_bytes[site[i]] += mavalloc_usable_size( live[i] );
+    }
+  }
+
+  if( period != 0 && period < 8192 )
+  {
+    if( mavalloc_profile_dump( "benchmark14.heap" ) != 0 )
+    {
+      printf( "could not write benchmark14.heap\n" );
+    }
+  }
+  mavalloc_profile_stop( );
+  mavalloc_destroy( );
+  return elapsed;
+}
+
+int main( int argc, char * argv[] )
+{
+  static const size_t periods[] = { 0, 512 * 1024, 64 * 1024, 4096 };
+  size_t live_bytes[3];
+  double baseline = 0.0;
+  unsigned int p;
+
+  printf( "%-10s %10s %12s %10s\n", "period", "ms", "Mops/s", "overhead" );
+  for( p = 0; p < sizeof( periods ) / sizeof( periods[0] ); p++ )
+  {
+    double ms = churn( periods[p], live_bytes );
+
+    if( periods[p] == 0 )
+    {
+      baseline = ms;
+      printf( "%-10s", "off" );
+    }
+    else
+    {
+      printf( "%-10zu", periods[p] );
+    }
+    printf( " %10.1f %12.2f %9.1f%%\n", ms, OPS / ms / 1000.0, ( ms / baseline - 1.0 ) * 100.0 );
+  }
+
+  printf( "\nlive bytes at the end: small %zu, medium %zu, large %zu\n", live_bytes[0],
+          live_bytes[1], live_bytes[2] );
+  printf( "profile written to benchmark14.heap\n" );
+  return 0;
+}
@@ -0,0 +1,134 @@
+/**
+* benchmark15.c
+*
+* Largest free hole over time for a mix of long-lived small objects and
+* short-lived large buffers.  Every round allocates a few small objects, most
+* of which stay live for the rest of the run, and one large buffer that is
+* released a couple of rounds later.
+*
+* The four single-ended policies let the small objects settle in the gaps the
+* buffers leave behind, so the free space ends up cut into pieces too small
+* for the next buffer.  SEGREGATED keeps the small objects at the low end of
+* the arena and the buffers at the high end.
+*
+* The table prints the largest hole after every CHECKPOINT rounds, in KB,
+* followed by how many buffers could not be allocated.
+*
+*   gcc -O2 -o benchmark15 benchmark15.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE     ( 8 * 1024 * 1024 )
+#define ROUNDS         2000
+#define CHECKPOINT     200
+#define SMALL_PER      4
+#define SMALL_LIVE     6000
+#define BUFFER_MIN     ( 256 * 1024 )
+#define BUFFER_RANGE   ( 1024 * 1024 )
+#define BUFFER_LIFE    3
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT", "ADAPTIVE",
+                                "SEGREGATED" };
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static int run( enum ALGORITHM algorithm, size_t largest[] )
+{
+  static void * small[SMALL_LIVE];
+  void * buffers[BUFFER_LIFE] = { 0 };
+  int failures = 0;
+  int round, i;
+
+  seed = 2463534242u;
+  for( i = 0; i < SMALL_LIVE; i++ )
+  {
+    small[i] = NULL;
+  }
+  mavalloc_init( ARENA_SIZE, algorithm );
+
+  for( round = 0; round < ROUNDS; round++ )
+  {
+    int slot = round % BUFFER_LIFE;
+
+    mavalloc_free( buffers[slot] );
+    buffers[slot] = mavalloc_alloc( BUFFER_MIN + next_random( ) % BUFFER_RANGE );
+    if( buffers[slot] == NULL )
+    {
+      failures++;
+    }
+
+    /* One in eight small objects is replaced, the rest accumulate */
+    for( i = 0; i < SMALL_PER; i++ )
+    {
+      int victim = next_random( ) % SMALL_LIVE;
+
+      if( next_random( ) % 8 == 0 )
+      {
+        mavalloc_free( small[victim] );
+        small[victim] = NULL;
+      }
+      victim = next_random( ) % SMALL_LIVE;
+      if( small[victim] == NULL )
+      {
+        small[victim] = mavalloc_alloc( 32 + next_random( ) % 1500 );
+      }
+    }
+
+    if( ( round + 1 ) % CHECKPOINT == 0 )
+    {
+      largest[round / CHECKPOINT] = mavalloc_largest_hole( );
+    }
+  }
+
+  mavalloc_destroy( );
+  return failures;
+}
+
+int main( int argc, char * argv[] )
+{
+  size_t largest[SEGREGATED + 1][ROUNDS / CHECKPOINT];
+  int failures[SEGREGATED + 1];
+  int algorithm;
+  int i;
+
+  for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+  {
+    failures[algorithm] = run( algorithm, largest[algorithm] );
+  }
+
+  printf( "largest hole in KB, %d KB arena\n", ARENA_SIZE / 1024 );
+  printf( "%8s", "round" );
+  for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+  {
+    printf( " %11s", names[algorithm] );
+  }
+  printf( "\n" );
+
+  for( i = 0; i < ROUNDS / CHECKPOINT; i++ )
+  {
+    printf( "%8d", ( i + 1 ) * CHECKPOINT );
+    for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+    {
+      printf( " %11zu", largest[algorithm][i] / 1024 );
+    }
+    printf( "\n" );
+  }
+
+  printf( "%8s", "failed" );
+  for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+  {
+    printf( " %11d", failures[algorithm] );
+  }
+  printf( "\n" );
+  return 0;
+}
@@ -0,0 +1,167 @@
+/**
+* benchmark16.cpp
+*
+* Container heavy request handling on the C++ interfaces in mavalloc.hpp
+* against std::allocator.  Every request builds a vector, an unordered_map
+* and a map, looks a few things up in them and throws them all away:
+*
+*   std::allocator        the containers as they come
+*   mavalloc_allocator    the same containers with mavalloc_allocator<T>
+*   mavalloc_resource     std::pmr containers on mavalloc_resource
+*   monotonic             std::pmr containers on a mavalloc_monotonic_resource
+*                         created for the request and dropped with it
+*
+*   gcc -O2 -c mavalloc.c
+*   g++ -O2 -std=c++17 -o benchmark16 benchmark16.cpp mavalloc.o
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "mavalloc.hpp"
+
+#define ARENA_SIZE   ( 64 * 1024 * 1024 )
+#define REQUESTS     2000
+#define ELEMENTS     1000
+#define ENTRIES      200
+
+static double now_ms( )
+{
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+}
+
+/* One request: fill the containers, query them, return a checksum */
+template <class Vector, class Hash, class Tree>
+static long handle( int request, Vector & values, Hash & index, Tree & ordered )
+{
+  long sum = 0;
+  int i;
+
+  for( i = 0; i < ELEMENTS; i++ )
+  {
+    values.push_back( request * 31 + i );
+  }
+  for( i = 0; i < ENTRIES; i++ )
+  {
+    index[ values[ ( i * 7 ) % ELEMENTS ] ] = i;
+    ordered.emplace( values[ ( i * 13 ) % ELEMENTS ], i );
+  }
+  for( i = 0; i < ELEMENTS; i += 5 )
+  {
+    auto found = index.find( values[i] );
+    if( found != index.end( ) )
+    {
+      sum += found->second;
+    }
+    auto lower = ordered.lower_bound( values[i] );
+    if( lower != ordered.end( ) )
+    {
+      sum += lower->second;
+    }
+  }
+  return sum;
+}
+
+static long run_std( )
+{
+  long sum = 0;
+
+  for( int r = 0; r < REQUESTS; r++ )
+  {
+    std::vector<int> values;
+    std::unordered_map<int, int> index;
+    std::map<int, int> ordered;
+    sum += handle( r, values, index, ordered );
+  }
+  return sum;
+}
+
+static long run_allocator( )
+{
+  using Vector = std::vector<int, mavalloc_allocator<int>>;
+  using Hash = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                                  mavalloc_allocator<std::pair<const int, int>>>;
+  using Tree = std::map<int, int, std::less<int>, mavalloc_allocator<std::pair<const int, int>>>;
+  long sum = 0;
+
+  for( int r = 0; r < REQUESTS; r++ )
+  {
+    Vector values;
+    Hash index;
+    Tree ordered;
+    sum += handle( r, values, index, ordered );
+  }
+  return sum;
+}
+
+static long run_resource( )
+{
+  long sum = 0;
+
+  for( int r = 0; r < REQUESTS; r++ )
+  {
+    std::pmr::vector<int> values( mavalloc_default_resource( ) );
+    std::pmr::unordered_map<int, int> index( mavalloc_default_resource( ) );
+    std::pmr::map<int, int> ordered( mavalloc_default_resource( ) );
+    sum += handle( r, values, index, ordered );
+  }
+  return sum;
+}
+
+static long run_monotonic( )
+{
+  long sum = 0;
+
+  for( int r = 0; r < REQUESTS; r++ )
+  {
+    mavalloc_monotonic_resource arena( 64 * 1024 );
+    std::pmr::vector<int> values( &arena );
+    std::pmr::unordered_map<int, int> index( &arena );
+    std::pmr::map<int, int> ordered( &arena );
+    sum += handle( r, values, index, ordered );
+  }
+  return sum;
+}
+
+int main( )
+{
+  struct
+  {
+    const char * name;
+    long ( *run )( );
+  } configurations[] = {
+    { "std::allocator", run_std },
+    { "mavalloc_allocator", run_allocator },
+    { "mavalloc_resource", run_resource },
+    { "monotonic", run_monotonic },
+  };
+  double baseline = 0.0;
+
+  mavalloc_init( ARENA_SIZE, FIRST_FIT );
+
+  std::printf( "%d requests of %d vector elements and %d map entries\n", REQUESTS, ELEMENTS,
+               ENTRIES );
+  std::printf( "%-20s %10s %12s %9s %10s\n", "allocator", "ms", "requests/s", "speedup",
+               "checksum" );
+  for( auto & configuration : configurations )
+  {
+    double start = now_ms( );
+    long sum = configuration.run( );
+    double ms = now_ms( ) - start;
+
+    if( baseline == 0.0 )
+    {
+      baseline = ms;
+    }
+    std::printf( "%-20s %10.1f %12.0f %8.2fx %10ld\n", configuration.name, ms,
+                 REQUESTS / ms * 1000.0, baseline / ms, sum );
+  }
+
+  mavalloc_destroy( );
+  return 0;
+}
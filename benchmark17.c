@@ -0,0 +1,129 @@
+/**
+* benchmark17.c
+*
+* Tail latency of mavalloc_alloc and mavalloc_free for every placement
+* policy.  The same churn of mixed size blocks runs against each policy with
+* the ledger kept a few thousand nodes long, then the latency histograms are
+* summarized as percentiles.  Averages hide the slow calls, the long hole
+* list walks and the ledger scans that look up a freed pointer; the 99.9th
+* percentile and the maximum show them.
+*
+* Percentiles are the upper bound of the histogram bucket they fall in, in
+* cycles of the processor's time stamp counter.
+*
+* mavalloc.c must be compiled with the statistics enabled:
+*
+*   gcc -O2 -DMAVALLOC_STATS -o benchmark17 benchmark17.c mavalloc.c
+*
+* With sys/sdt.h installed the same binary carries tracepoints, for example
+*
+*   bpftrace -e 'usdt:./benchmark17:mavalloc:ledger_insert { @nodes = hist(arg1); }' \
+*            -c ./benchmark17
+*/
+
+#include <stdio.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE  ( 16 * 1024 * 1024 )
+#define LIVE        2000
+#define OPS         100000
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT", "ADAPTIVE",
+                                "SEGREGATED" };
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void churn( enum ALGORITHM algorithm )
+{
+  static void * live[LIVE];
+  int i;
+
+  seed = 2463534242u;
+  mavalloc_init( ARENA_SIZE, algorithm );
+  for( i = 0; i < LIVE; i++ )
+  {
+    live[i] = mavalloc_alloc( 16 + next_random( ) % 2048 );
+  }
+  for( i = 0; i < OPS; i++ )
+  {
+    int slot = next_random( ) % LIVE;
+
+    mavalloc_free( live[slot] );
+    live[slot] = mavalloc_alloc( 16 + next_random( ) % 2048 );
+  }
+  for( i = 0; i < LIVE; i++ )
+  {
+    mavalloc_free( live[i] );
+  }
+  mavalloc_destroy( );
+}
+
+/* Upper bound of the bucket holding the given fraction of the operations */
+static unsigned long percentile( const unsigned long counts[], unsigned long total, double fraction )
+{
+  unsigned long seen = 0;
+  int bucket;
+
+  for( bucket = 0; bucket < MAVALLOC_LATENCY_BUCKETS; bucket++ )
+  {
+    seen += counts[bucket];
+    if( seen > 0 && seen >= total * fraction )
+    {
+      return 2ul << bucket;
+    }
+  }
+  return 0;
+}
+
+static void report( const char * label, enum MAVALLOC_OPERATION operation, enum ALGORITHM algorithm )
+{
+  unsigned long counts[MAVALLOC_LATENCY_BUCKETS];
+  unsigned long total = 0;
+  int bucket;
+
+  mavalloc_latency_histogram( operation, algorithm, counts );
+  for( bucket = 0; bucket < MAVALLOC_LATENCY_BUCKETS; bucket++ )
+  {
+    total += counts[bucket];
+  }
+  if( total == 0 )
+  {
+    return;
+  }
+  printf( "%-10s %-6s %8lu %9lu %9lu %9lu %9lu %10lu\n", names[algorithm], label, total,
+          percentile( counts, total, 0.5 ), percentile( counts, total, 0.99 ),
+          percentile( counts, total, 0.999 ), percentile( counts, total, 0.9999 ),
+          percentile( counts, total, 1.0 ) );
+}
+
+int main( int argc, char * argv[] )
+{
+  unsigned long counts[MAVALLOC_LATENCY_BUCKETS];
+  int algorithm;
+
+  if( mavalloc_latency_histogram( MAVALLOC_OP_ALLOC, FIRST_FIT, counts ) != 0 )
+  {
+    printf( "mavalloc.c was compiled without -DMAVALLOC_STATS\n" );
+    return 1;
+  }
+
+  printf( "latency in cycles, %d live blocks, %d operations\n", LIVE, OPS );
+  printf( "%-10s %-6s %8s %9s %9s %9s %9s %10s\n", "algorithm", "op", "calls", "p50", "p99",
+          "p99.9", "p99.99", "max" );
+  for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+  {
+    mavalloc_latency_reset( );
+    churn( algorithm );
+    report( "alloc", MAVALLOC_OP_ALLOC, algorithm );
+    report( "free", MAVALLOC_OP_FREE, algorithm );
+  }
+  return 0;
+}
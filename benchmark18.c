@@ -0,0 +1,152 @@
+/**
+* benchmark18.c
+*
+* Nested temporaries the way a recursive descent parser makes them.  A symbol
+* table of long-lived entries is allocated first, then every parse builds an
+* expression tree: each level takes a node and a token buffer, parses its
+* children and gives the buffer back.  The tree is released three ways:
+*
+*   scoped    every level frees its node and buffer on the way back out, so
+*             each free is the most recent allocation
+*   reverse   the whole tree is kept until the parse ends and freed newest
+*             first, still last in, first out
+*   forward   the same tree freed oldest first
+*
+* A last in, first out free hits the block at the top of the used region and
+* is found without scanning the ledger.  The forward order pays the scan for
+* every block, with the symbol table making the ledger long.  The speedup is
+* the forward time over the reverse time.
+*
+*   gcc -O2 -o benchmark18 benchmark18.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE  ( 16 * 1024 * 1024 )
+#define SYMBOLS     3000
+#define PARSES      100
+#define DEPTH       8
+#define FANOUT      2
+#define TREE_MAX    1024
+
+enum ORDER
+{
+  SCOPED = 0,
+  REVERSE,
+  FORWARD
+};
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT", "ADAPTIVE",
+                                "SEGREGATED" };
+
+static unsigned int seed;
+
+/* Blocks of the tree in allocation order, for the REVERSE and FORWARD runs */
+static void * tree[TREE_MAX * 2];
+static int tree_count;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* One level of the parse: a node, a token buffer and the children below it */
+static void parse( int depth, enum ORDER order )
+{
+  void * node = mavalloc_alloc( 48 );
+  void * token = mavalloc_alloc( 16 + next_random( ) % 200 );
+  int i;
+
+  if( order != SCOPED )
+  {
+    tree[tree_count++] = node;
+    tree[tree_count++] = token;
+  }
+  if( depth > 0 )
+  {
+    for( i = 0; i < FANOUT; i++ )
+    {
+      parse( depth - 1, order );
+    }
+  }
+  if( order == SCOPED )
+  {
+    mavalloc_free( token );
+    mavalloc_free( node );
+  }
+}
+
+static double run( enum ALGORITHM algorithm, enum ORDER order )
+{
+  static void * symbols[SYMBOLS];
+  double start;
+  double ms;
+  int i, p;
+
+  seed = 2463534242u;
+  mavalloc_init( ARENA_SIZE, algorithm );
+  for( i = 0; i < SYMBOLS; i++ )
+  {
+    symbols[i] = mavalloc_alloc( 16 + next_random( ) % 64 );
+  }
+
+  start = now_ms( );
+  for( p = 0; p < PARSES; p++ )
+  {
+    tree_count = 0;
+    parse( DEPTH, order );
+    if( order == REVERSE )
+    {
+      for( i = tree_count - 1; i >= 0; i-- )
+      {
+        mavalloc_free( tree[i] );
+      }
+    }
+    else if( order == FORWARD )
+    {
+      for( i = 0; i < tree_count; i++ )
+      {
+        mavalloc_free( tree[i] );
+      }
+    }
+  }
+  ms = now_ms( ) - start;
+
+  for( i = 0; i < SYMBOLS; i++ )
+  {
+    mavalloc_free( symbols[i] );
+  }
+  mavalloc_destroy( );
+  return ms;
+}
+
+int main( int argc, char * argv[] )
+{
+  int algorithm;
+
+  printf( "%d parses of %d blocks over %d live symbols, ms\n", PARSES,
+          2 * ( ( 1 << ( DEPTH + 1 ) ) - 1 ), SYMBOLS );
+  printf( "%-10s %9s %9s %9s %9s\n", "algorithm", "scoped", "reverse", "forward", "speedup" );
+  for( algorithm = FIRST_FIT; algorithm <= SEGREGATED; algorithm++ )
+  {
+    double scoped = run( algorithm, SCOPED );
+    double reverse = run( algorithm, REVERSE );
+    double forward = run( algorithm, FORWARD );
+
+    printf( "%-10s %9.2f %9.2f %9.2f %8.1fx\n", names[algorithm], scoped, reverse, forward,
+            forward / reverse );
+  }
+  return 0;
+}
@@ -6,12 +6,12 @@ int main( int argc, char * argv[] )
   mavalloc_init( 1000000, WORST_FIT );
 
   int i = 0;
-  for( i = 0; i < 1000; i ++)
+  for( i = 0; i < 10000; i ++)
   {
     array[i] = mavalloc_alloc( 100 );
   }
 
-  for( i = 0; i < 1000; i ++)
+  for( i = 0; i < 10000; i ++)
   {
     mavalloc_free( array[i] );
   }
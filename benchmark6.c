@@ -0,0 +1,441 @@
+/**
+* benchmark6.c
+*
+* Multi-threaded scaling benchmark.  Runs 1..N workers doing alloc/free churn
+* against mavalloc and, as a baseline, the system malloc in three setups:
+*
+*   private  - every worker owns its own arena.  mavalloc keeps one arena per
+*              process so each worker is forked into its own process.
+*   shared   - all threads share one arena behind a single mutex.
+*   handoff  - producer/consumer: every thread allocates blocks and hands them
+*              to the next thread, which frees them.
+*
+* Reports aggregate throughput, scaling efficiency against one worker and the
+* tail latency of the slowest worker.
+*
+*   gcc -O2 -o benchmark6 benchmark6.c mavalloc.c -lpthread
+*   ./benchmark6 [max_threads] [ops_per_thread]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE    ( 16 * 1024 * 1024 )
+#define LIVE_SLOTS    64
+#define RING_SIZE     128
+#define MIN_BLOCK     16
+#define MAX_BLOCK     256
+#define MAX_THREADS   64
+
+enum MODE
+{
+  PRIVATE = 0,
+  SHARED,
+  HANDOFF
+};
+
+static const char * mode_names[] = { "private", "shared", "handoff" };
+
+struct allocator
+{
+  const char * name;
+  void * ( *alloc )( size_t );
+  void ( *free )( void * );
+};
+
+/* Each worker's latency summary.  Lives in shared memory so forked workers
+ * can report back the same way threads do.
+ */
+struct result
+{
+  long     ops;
+  long     failures;
+  uint32_t p50;
+  uint32_t p99;
+  uint32_t p999;
+  uint32_t max;
+};
+
+struct ring
+{
+  pthread_mutex_t lock;
+  int    head;
+  int    count;
+  void * slot[RING_SIZE];
+};
+
+struct worker
+{
+  int                      id;
+  int                      threads;
+  long                     ops;
+  enum MODE                mode;
+  const struct allocator * allocator;
+  struct result *          result;
+  uint32_t *               samples;
+};
+
+static pthread_mutex_t  arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              producing;
+static struct ring      rings[MAX_THREADS];
+
+static void * mavalloc_locked_alloc( size_t size )
+{
+  void * ptr;
+  pthread_mutex_lock( &arena_lock );
+  ptr = mavalloc_alloc( size );
+  pthread_mutex_unlock( &arena_lock );
+  return ptr;
+}
+
+static void mavalloc_locked_free( void * ptr )
+{
+  pthread_mutex_lock( &arena_lock );
+  mavalloc_free( ptr );
+  pthread_mutex_unlock( &arena_lock );
+}
+
+static void * system_alloc( size_t size )
+{
+  return malloc( size );
+}
+
+static void system_free( void * ptr )
+{
+  free( ptr );
+}
+
+static const struct allocator allocators[] =
+{
+  { "mavalloc", mavalloc_locked_alloc, mavalloc_locked_free },
+  { "malloc",   system_alloc,          system_free          },
+};
+
+static inline uint64_t now_ns( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint32_t next_random( uint32_t * state )
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static int compare_samples( const void * a, const void * b )
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return ( x > y ) - ( x < y );
+}
+
+static void summarize( struct worker * w, long n )
+{
+  qsort( w->samples, n, sizeof( uint32_t ), compare_samples );
+  w->result->ops  = n;
+  w->result->p50  = n ? w->samples[ n / 2 ] : 0;
+  w->result->p99  = n ? w->samples[ n * 99 / 100 ] : 0;
+  w->result->p999 = n ? w->samples[ n * 999 / 1000 ] : 0;
+  w->result->max  = n ? w->samples[ n - 1 ] : 0;
+}
+
+static inline uint32_t timed_free( const struct allocator * a, void * ptr )
+{
+  uint64_t start = now_ns( );
+  a->free( ptr );
+  return (uint32_t)( now_ns( ) - start );
+}
+
+static int ring_push( struct ring * r, void * ptr )
+{
+  int ok = 0;
+  pthread_mutex_lock( &r->lock );
+  if( r->count < RING_SIZE )
+  {
+    r->slot[ ( r->head + r->count ) % RING_SIZE ] = ptr;
+    r->count++;
+    ok = 1;
+  }
+  pthread_mutex_unlock( &r->lock );
+  return ok;
+}
+
+static void * ring_pop( struct ring * r )
+{
+  void * ptr = NULL;
+  pthread_mutex_lock( &r->lock );
+  if( r->count > 0 )
+  {
+    ptr = r->slot[ r->head ];
+    r->head = ( r->head + 1 ) % RING_SIZE;
+    r->count--;
+  }
+  pthread_mutex_unlock( &r->lock );
+  return ptr;
+}
+
+/* Free everything other threads have handed to us */
+static long drain( struct worker * w, long n )
+{
+  void * ptr;
+  while( ( ptr = ring_pop( &rings[ w->id ] ) ) != NULL )
+  {
+    w->samples[ n++ ] = timed_free( w->allocator, ptr );
+  }
+  return n;
+}
+
+static void churn( struct worker * w )
+{
+  const struct allocator * a = w->allocator;
+  void *   live[LIVE_SLOTS];
+  uint32_t seed = 2463534242u + w->id * 7919u;
+  long     n = 0;
+  long     i;
+
+  memset( live, 0, sizeof( live ) );
+
+  for( i = 0; i < w->ops; i++ )
+  {
+    size_t   size = MIN_BLOCK + next_random( &seed ) % ( MAX_BLOCK - MIN_BLOCK );
+    uint64_t start = now_ns( );
+    void *   ptr = a->alloc( size );
+    w->samples[ n++ ] = (uint32_t)( now_ns( ) - start );
+
+    if( ptr == NULL )
+    {
+      w->result->failures++;
+      continue;
+    }
+    memset( ptr, 0xA5, MIN_BLOCK );
+
+    if( w->mode == HANDOFF )
+    {
+      struct ring * next = &rings[ ( w->id + 1 ) % w->threads ];
+      while( !ring_push( next, ptr ) )
+      {
+        n = drain( w, n );
+        sched_yield( );
+      }
+      n = drain( w, n );
+    }
+    else
+    {
+      int slot = next_random( &seed ) % LIVE_SLOTS;
+      if( live[slot] )
+      {
+        w->samples[ n++ ] = timed_free( a, live[slot] );
+      }
+      live[slot] = ptr;
+    }
+  }
+
+  /* Keep draining until every producer is done so nobody blocks on our ring */
+  if( w->mode == HANDOFF )
+  {
+    __atomic_add_fetch( &producing, -1, __ATOMIC_SEQ_CST );
+    while( __atomic_load_n( &producing, __ATOMIC_SEQ_CST ) > 0 )
+    {
+      n = drain( w, n );
+      sched_yield( );
+    }
+    n = drain( w, n );
+  }
+
+  for( i = 0; i < LIVE_SLOTS; i++ )
+  {
+    if( live[i] )
+    {
+      a->free( live[i] );
+    }
+  }
+
+  summarize( w, n );
+}
+
+static void * thread_main( void * arg )
+{
+  churn( (struct worker *)arg );
+  return NULL;
+}
+
+/* Run one configuration and return the wall time in nanoseconds */
+static uint64_t run( const struct allocator * a, enum MODE mode, int threads,
+                     long ops, struct result * results )
+{
+  struct worker workers[MAX_THREADS];
+  pthread_t     tid[MAX_THREADS];
+  pid_t         pid[MAX_THREADS];
+  uint64_t      start;
+  int           i;
+
+  memset( results, 0, sizeof( struct result ) * threads );
+
+  for( i = 0; i < threads; i++ )
+  {
+    workers[i].id = i;
+    workers[i].threads = threads;
+    workers[i].ops = ops;
+    workers[i].mode = mode;
+    workers[i].allocator = a;
+    workers[i].result = &results[i];
+    workers[i].samples = malloc( sizeof( uint32_t ) * ( ops * 2 + RING_SIZE ) );
+    pthread_mutex_init( &rings[i].lock, NULL );
+    rings[i].head = 0;
+    rings[i].count = 0;
+  }
+  producing = threads;
+
+  start = now_ns( );
+
+  if( mode == PRIVATE )
+  {
+    for( i = 0; i < threads; i++ )
+    {
+      pid[i] = fork( );
+      if( pid[i] == 0 )
+      {
+        if( a->alloc == mavalloc_locked_alloc )
+        {
+          mavalloc_init( ARENA_SIZE, FIRST_FIT );
+        }
+        churn( &workers[i] );
+        _exit( 0 );
+      }
+    }
+    for( i = 0; i < threads; i++ )
+    {
+      waitpid( pid[i], NULL, 0 );
+    }
+  }
+  else
+  {
+    if( a->alloc == mavalloc_locked_alloc )
+    {
+      mavalloc_init( ARENA_SIZE, FIRST_FIT );
+    }
+    for( i = 0; i < threads; i++ )
+    {
+      pthread_create( &tid[i], NULL, thread_main, &workers[i] );
+    }
+    for( i = 0; i < threads; i++ )
+    {
+      pthread_join( tid[i], NULL );
+    }
+    if( a->alloc == mavalloc_locked_alloc )
+    {
+      mavalloc_destroy( );
+    }
+  }
+
+  uint64_t elapsed = now_ns( ) - start;
+
+  for( i = 0; i < threads; i++ )
+  {
+    free( workers[i].samples );
+    pthread_mutex_destroy( &rings[i].lock );
+  }
+  return elapsed;
+}
+
+/* Double the worker count each step but always finish on max */
+static int next_count( int threads, int max_threads )
+{
+  if( threads < max_threads && threads * 2 > max_threads )
+  {
+    return max_threads;
+  }
+  return threads * 2;
+}
+
+int main( int argc, char * argv[] )
+{
+  int  max_threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+  long ops = 100000;
+  int  a, m, threads, i;
+
+  if( argc > 1 )
+  {
+    max_threads = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    ops = atol( argv[2] );
+  }
+  if( max_threads < 1 )
+  {
+    max_threads = 1;
+  }
+  if( max_threads > MAX_THREADS )
+  {
+    max_threads = MAX_THREADS;
+  }
+
+  struct result * results = mmap( NULL, sizeof( struct result ) * MAX_THREADS,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+  if( results == MAP_FAILED )
+  {
+    perror( "mmap" );
+    return 1;
+  }
+
+  printf( "%-9s %-8s %7s %10s %10s %9s %9s %9s %9s %9s\n",
+          "allocator", "mode", "threads", "Mops/s", "efficiency",
+          "p50 ns", "p99 ns", "p99.9 ns", "max ns", "failures" );
+
+  for( m = PRIVATE; m <= HANDOFF; m++ )
+  {
+    for( a = 0; a < (int)( sizeof( allocators ) / sizeof( allocators[0] ) ); a++ )
+    {
+      double single = 0.0;
+
+      for( threads = 1; threads <= max_threads; threads = next_count( threads, max_threads ) )
+      {
+        uint64_t elapsed = run( &allocators[a], m, threads, ops, results );
+        long     total = 0, failures = 0;
+        uint32_t p50 = 0, p99 = 0, p999 = 0, max = 0;
+
+        /* Tail latency is reported for the worst worker */
+        for( i = 0; i < threads; i++ )
+        {
+          total += results[i].ops;
+          failures += results[i].failures;
+          if( results[i].p50 > p50 )   p50 = results[i].p50;
+          if( results[i].p99 > p99 )   p99 = results[i].p99;
+          if( results[i].p999 > p999 ) p999 = results[i].p999;
+          if( results[i].max > max )   max = results[i].max;
+        }
+
+        double mops = (double)total * 1000.0 / (double)elapsed;
+        if( threads == 1 )
+        {
+          single = mops;
+        }
+
+        printf( "%-9s %-8s %7d %10.2f %9.0f%% %9u %9u %9u %9u %9ld\n",
+                allocators[a].name, mode_names[m], threads, mops,
+                100.0 * mops / ( single * threads ),
+                p50, p99, p999, max, failures );
+        fflush( stdout );
+      }
+    }
+  }
+
+  munmap( results, sizeof( struct result ) * MAX_THREADS );
+  return 0;
+}
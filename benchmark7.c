@@ -0,0 +1,207 @@
+/**
+* benchmark7.c
+*
+* Phased workload for the ADAPTIVE placement policy.  The run alternates
+* between bursty phases, where thousands of small messages are allocated and
+* released together, and long-running phases, where a large mixed-size working
+* set is slowly replaced and fragments the arena.  A long-lived set of blocks
+* allocated in the first phase stays live throughout.
+*
+* Every policy runs the identical sequence.  A request that fails is retried
+* after evicting the oldest live block, as a cache would, so each failure
+* costs time and a lost object.  Evictions are the primary measure: a policy
+* that is fast because it throws objects away is not serving the workload.
+* Time compares the policies that keep their objects.
+*
+* ADAPTIVE runs with its fragmentation limit lowered to ADAPTIVE_FRAGMENTATION
+* percent from the default 50, so it moves to BEST_FIT before the steady
+* phases cut up the arena.  FIRST_FIT and NEXT_FIT stay faster, at the cost
+* of thousands of evictions.
+*
+*   gcc -O2 -o benchmark7 benchmark7.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE      ( 2800 * 1024 )
+#define PHASES          6
+#define BURST_ROUNDS    10
+#define BURST_SIZE      5000
+#define STEADY_OPS      40000
+#define STEADY_LIVE     1200
+#define PINNED          600
+#define REPEATS         5
+
+/* Passed to mavalloc_set_adaptive_limits, the window and search limits keep
+ * their defaults
+ */
+#define ADAPTIVE_FRAGMENTATION  25
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT", "ADAPTIVE" };
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Steady phase working set, kept as a FIFO so the oldest block is evicted */
+static void * steady[STEADY_LIVE];
+static int    steady_head;
+static int    steady_count;
+
+static long failures;
+static long switches;
+
+static void * alloc_or_evict( size_t size )
+{
+  void * ptr = mavalloc_alloc( size );
+
+  while( ptr == NULL && steady_count > 0 )
+  {
+    failures++;
+    mavalloc_free( steady[ steady_head ] );
+    steady_head = ( steady_head + 1 ) % STEADY_LIVE;
+    steady_count--;
+    ptr = mavalloc_alloc( size );
+  }
+  return ptr;
+}
+
+static void * tracked_alloc( size_t size )
+{
+  enum ALGORITHM before = mavalloc_get_algorithm( );
+  void * ptr = alloc_or_evict( size );
+  if( mavalloc_get_algorithm( ) != before )
+  {
+    switches++;
+  }
+  return ptr;
+}
+
+static void burst_phase( )
+{
+  static void * burst[BURST_SIZE];
+  int round, i;
+
+  for( round = 0; round < BURST_ROUNDS; round++ )
+  {
+    for( i = 0; i < BURST_SIZE; i++ )
+    {
+      burst[i] = tracked_alloc( 32 + next_random( ) % 32 );
+    }
+    for( i = 0; i < BURST_SIZE; i++ )
+    {
+      mavalloc_free( burst[i] );
+    }
+  }
+}
+
+static void steady_phase( )
+{
+  int i;
+
+  for( i = 0; i < STEADY_OPS; i++ )
+  {
+    void * ptr;
+
+    if( steady_count == STEADY_LIVE )
+    {
+      /* Replace a random block rather than the oldest so holes scatter */
+      int victim = ( steady_head + next_random( ) % STEADY_LIVE ) % STEADY_LIVE;
+      mavalloc_free( steady[victim] );
+      steady[victim] = steady[ steady_head ];
+      steady_head = ( steady_head + 1 ) % STEADY_LIVE;
+      steady_count--;
+    }
+
+    ptr = tracked_alloc( 64 + next_random( ) % 4096 );
+    if( ptr != NULL )
+    {
+      steady[ ( steady_head + steady_count ) % STEADY_LIVE ] = ptr;
+      steady_count++;
+    }
+  }
+}
+
+/* Run the whole phased sequence once and return the elapsed time */
+static double run( enum ALGORITHM algorithm )
+{
+  double start;
+  int    phase, i;
+
+  seed = 2463534242u;
+  steady_head = 0;
+  steady_count = 0;
+  failures = 0;
+  switches = 0;
+
+  mavalloc_init( ARENA_SIZE, algorithm );
+  mavalloc_set_adaptive_limits( 0, 0, ADAPTIVE_FRAGMENTATION );
+
+  start = now_ms( );
+
+  for( i = 0; i < PINNED; i++ )
+  {
+    tracked_alloc( 16 + next_random( ) % 64 );
+    if( i % 2 == 0 )
+    {
+      mavalloc_free( tracked_alloc( 16 + next_random( ) % 64 ) );
+    }
+  }
+
+  for( phase = 0; phase < PHASES; phase++ )
+  {
+    if( phase % 2 == 0 )
+    {
+      burst_phase( );
+    }
+    else
+    {
+      steady_phase( );
+    }
+  }
+
+  double elapsed = now_ms( ) - start;
+  mavalloc_destroy( );
+  return elapsed;
+}
+
+int main( int argc, char * argv[] )
+{
+  int algorithm, repeat;
+
+  printf( "%-10s %10s %10s %10s\n", "algorithm", "evictions", "time ms", "switches" );
+
+  for( algorithm = FIRST_FIT; algorithm <= ADAPTIVE; algorithm++ )
+  {
+    /* The sequence is deterministic, keep the fastest of a few runs */
+    double best = 0.0;
+
+    for( repeat = 0; repeat < REPEATS; repeat++ )
+    {
+      double elapsed = run( algorithm );
+      if( repeat == 0 || elapsed < best )
+      {
+        best = elapsed;
+      }
+    }
+
+    printf( "%-10s %10ld %10.1f %10ld\n", names[algorithm], failures, best, switches );
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/**
+* benchmark8.c
+*
+* Same-size message churn with and without deferred coalescing.  A window of
+* live messages drawn from a few fixed sizes is continuously replaced: each
+* step frees a random message and allocates a new one of the same size, the
+* pattern of a message queue or connection pool.
+*
+* With immediate coalescing every free merges the block back into its
+* neighbours and the next allocation splits the merged hole again.  With
+* deferred coalescing the freed block is handed straight back.
+*
+*   gcc -O2 -o benchmark8 benchmark8.c mavalloc.c
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE  ( 8 * 1024 * 1024 )
+#define LIVE        2000
+#define OPS         200000
+
+static const char * names[] = { "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT" };
+static const size_t sizes[] = { 64, 128, 256, 512 };
+
+static unsigned int seed;
+
+static unsigned int next_random( )
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double run( enum ALGORITHM algorithm, int deferred, long * failures )
+{
+  static void * live[LIVE];
+  static size_t live_size[LIVE];
+  double start;
+  long i;
+
+  seed = 2463534242u;
+  *failures = 0;
+
+  mavalloc_init( ARENA_SIZE, algorithm );
+  mavalloc_set_deferred_coalescing( deferred );
+
+  for( i = 0; i < LIVE; i++ )
+  {
+    live_size[i] = sizes[ next_random( ) % 4 ];
+    live[i] = mavalloc_alloc( live_size[i] );
+  }
+
+  start = now_ms( );
+
+  for( i = 0; i < OPS; i++ )
+  {
+    int slot = next_random( ) % LIVE;
+
+    mavalloc_free( live[slot] );
+    live[slot] = mavalloc_alloc( live_size[slot] );
+    if( live[slot] == NULL )
+    {
+      ( *failures )++;
+    }
+  }
+
+  double elapsed = now_ms( ) - start;
+  mavalloc_destroy( );
+  return elapsed;
+}
+
+int main( int argc, char * argv[] )
+{
+  int algorithm;
+
+  printf( "%-10s %14s %14s %8s\n", "algorithm", "immediate ms", "deferred ms", "speedup" );
+
+  for( algorithm = FIRST_FIT; algorithm <= WORST_FIT; algorithm++ )
+  {
+    long   immediate_failures, deferred_failures;
+    double immediate = run( algorithm, 0, &immediate_failures );
+    double deferred = run( algorithm, 1, &deferred_failures );
+
+    printf( "%-10s %14.1f %14.1f %7.1fx", names[algorithm], immediate, deferred,
+            immediate / deferred );
+    if( immediate_failures || deferred_failures )
+    {
+      printf( "  (failures %ld / %ld)", immediate_failures, deferred_failures );
+    }
+    printf( "\n" );
+  }
+  return 0;
+}
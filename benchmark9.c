@@ -0,0 +1,166 @@
+/**
+* benchmark9.c
+*
+* Restart time of a file backed arena against rebuilding the same cache from
+* scratch.  The cache is an index of objects whose payload is regenerated from
+* the key, standing in for whatever a service does to load its data.
+*
+*   rebuild  - mavalloc_init, allocate every object, generate its payload and
+*              build the index
+*   restart  - mavalloc_open_persistent on the file written by a previous run,
+*              find the index through the root and walk every object
+*
+*   gcc -O2 -o benchmark9 benchmark9.c mavalloc.c
+*   ./benchmark9 [arena file]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mavalloc.h"
+
+#define ARENA_SIZE  ( 256 * 1024 * 1024 )
+#define OBJECTS     8000
+#define MIN_PAYLOAD 4096
+#define MAX_PAYLOAD 28672
+
+struct object
+{
+  size_t        key;
+  size_t        length;
+  unsigned char payload[];
+};
+
+/* Offsets, not pointers, so the index survives being mapped elsewhere */
+struct index
+{
+  size_t count;
+  size_t object[OBJECTS];
+};
+
+static double now_ms( )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void generate( struct object * object, size_t key )
+{
+  unsigned int state = (unsigned int)key * 2654435761u + 1;
+  size_t i;
+
+  object->key = key;
+  for( i = 0; i < object->length; i++ )
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    object->payload[i] = (unsigned char)state;
+  }
+}
+
+/* Allocate and fill every object, returns 0 on success */
+static int build( )
+{
+  struct index * index = mavalloc_alloc( sizeof( struct index ) );
+  size_t key;
+
+  if( index == NULL )
+  {
+    return -1;
+  }
+
+  for( key = 0; key < OBJECTS; key++ )
+  {
+    size_t length = MIN_PAYLOAD + ( key * 7919 ) % ( MAX_PAYLOAD - MIN_PAYLOAD );
+    struct object * object = mavalloc_alloc( sizeof( struct object ) + length );
+
+    if( object == NULL )
+    {
+      return -1;
+    }
+    object->length = length;
+    generate( object, key );
+    index->object[key] = mavalloc_to_offset( object );
+  }
+  index->count = OBJECTS;
+  mavalloc_set_root( index );
+  return 0;
+}
+
+/* Touch every object through the index, returns a checksum */
+static size_t walk( )
+{
+  struct index * index = mavalloc_get_root( );
+  size_t sum = 0;
+  size_t i;
+
+  if( index == NULL )
+  {
+    return 0;
+  }
+  for( i = 0; i < index->count; i++ )
+  {
+    struct object * object = mavalloc_from_offset( index->object[i] );
+    sum += object->key + object->payload[ object->length - 1 ];
+  }
+  return sum;
+}
+
+int main( int argc, char * argv[] )
+{
+  const char * path = argc > 1 ? argv[1] : "benchmark9.arena";
+  double start, rebuild, create, sync, restart;
+  size_t expected, restored;
+
+  unlink( path );
+
+  /* Baseline: a cold start rebuilds everything in an anonymous arena */
+  start = now_ms( );
+  mavalloc_init( ARENA_SIZE, FIRST_FIT );
+  if( build( ) != 0 )
+  {
+    printf( "rebuild failed\n" );
+    return 1;
+  }
+  expected = walk( );
+  rebuild = now_ms( ) - start;
+  mavalloc_destroy( );
+
+  /* First run of a persistent service: build once and checkpoint */
+  start = now_ms( );
+  if( mavalloc_open_persistent( path, ARENA_SIZE, FIRST_FIT ) != 0 || build( ) != 0 )
+  {
+    printf( "could not create %s\n", path );
+    return 1;
+  }
+  create = now_ms( ) - start;
+
+  start = now_ms( );
+  mavalloc_sync( );
+  sync = now_ms( ) - start;
+  mavalloc_destroy( );
+
+  /* Every later run: reopen the file and use the data as it is */
+  start = now_ms( );
+  if( mavalloc_open_persistent( path, ARENA_SIZE, FIRST_FIT ) != 0 )
+  {
+    printf( "could not reopen %s\n", path );
+    return 1;
+  }
+  restored = walk( );
+  restart = now_ms( ) - start;
+  mavalloc_destroy( );
+
+  printf( "%d objects, %d MB arena\n", OBJECTS, ARENA_SIZE / ( 1024 * 1024 ) );
+  printf( "rebuild             %10.2f ms\n", rebuild );
+  printf( "first persistent run%10.2f ms  (+ %.2f ms sync)\n", create, sync );
+  printf( "restart             %10.2f ms  %s\n", restart,
+          restored == expected ? "contents match" : "CONTENTS DIFFER" );
+  printf( "speedup             %10.1fx\n", rebuild / restart );
+
+  unlink( path );
+  return restored == expected ? 0 : 1;
+}
@@ -2,36 +2,55 @@
 *
 * This code implements a sorted linked list using an array as the underlying data structure.
 * The underlying implementation is to be hidden from the end user.  They should interact
-* with the linked list using the insertNode(int size) and removeNode(int size) functions.
+* with the linked list using the insertNode(long size) and removeNode(int node) functions.
 * The elements in the array are not sorted from element 0 to the end of the array and should
 * not be used in that manner.  The internal previous and next elements of the nodes are used
 * to traverse the linked list in order.
 *
 */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "mavalloc.h"
 
-/* The maximum entries in our linked list / array */
-#define MAX_LINKED_LIST_SIZE 10000
-
-/* *** INTERNAL USE ONLY *** In an in-line implementation the root node
- * is always 0
+/* Static tracepoints for perf and bpftrace, for example
+ *
+ *   bpftrace -e 'usdt:./program:mavalloc:ledger_insert { @nodes = hist(arg1); }'
+ *
+ * They are compiled in when the system has sys/sdt.h, where a probe nobody
+ * is attached to costs a nop, and left out otherwise or with
+ * -DMAVALLOC_NO_PROBES.
  */
-#define ROOTNODE 0
-
- /* *** INTERNAL USE ONLY *** Has the list been initialized */
-static int initialized = 0;
-
-/* *** INTERNAL USE ONLY *** Keep track of the last item placed
-* so we can optimize the shifting slightly and only shift what is needed.
-*/
-static int lastUsed = -1;
-
-static enum ALGORITHM gAlgorithm;
-static void * gArena;
+#if !defined( MAVALLOC_NO_PROBES ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#include <sys/sdt.h>
+#define PROBE1( name, a )         STAP_PROBE1( mavalloc, name, a )
+#define PROBE2( name, a, b )      STAP_PROBE2( mavalloc, name, a, b )
+#define PROBE3( name, a, b, c )   STAP_PROBE3( mavalloc, name, a, b, c )
+#endif
+#endif
+
+#ifndef PROBE1
+#define PROBE1( name, a )
+#define PROBE2( name, a, b )
+#define PROBE3( name, a, b, c )
+#endif
 
+/* The maximum entries in our linked list / array */
+#define MAX_LINKED_LIST_SIZE 10000
 
 /**
 *
@@ -65,10 +84,25 @@ enum TYPE {
 struct Node
 {
 	/** If this array entry is being used as a node. 1 for in-use. 0 for empty */
-	int  in_use;
-	int  size;
-	void * arena;
+	unsigned int in_use : 1;
+	/** 1 for an allocated block the heap profiler sampled, only frees of
+	 *  these take the profiler's lock */
+	unsigned int sampled : 1;
 	enum TYPE type;
+	long size;
+	/** Where the block starts, as an offset from the beginning of the arena so
+	 *  the ledger stays valid wherever the arena is mapped */
+	size_t offset;
+	/** Array index of the node before this one in address order, -1 for the
+	 *  first node */
+	int previous;
+	/** Array index of the node after this one in address order, -1 for the
+	 *  last node.  An entry not in use links to the next free entry */
+	int next;
+	/** For a hole, the holes before and after it in address order, -1 at
+	 *  either end.  Placement searches only walk these */
+	int previous_hole;
+	int next_hole;
 };
 
 /**
@@ -83,17 +117,180 @@ struct Node
 * The user will interface with the linked list through insertNode() and removeNode().  From the
 * end-user perspective it's a linked list.  We hide that we have implemented the list in an array.
 */
-static struct Node LinkedList[MAX_LINKED_LIST_SIZE];
+static struct Node StaticLinkedList[MAX_LINKED_LIST_SIZE];
+
+#define QUICK_LIST_SIZE 64
+
+/* A block parked by deferred coalescing */
+struct QuickEntry
+{
+  void * arena;
+  long size;
+};
+
+#define HUGE_TABLE_SIZE   64
+#define HUGE_TABLE_LIMIT  ( HUGE_TABLE_SIZE * 3 / 4 )
+
+/* A huge block mapped outside the arena */
+struct HugeBlock
+{
+  /** Start of the mapping, NULL for an empty slot */
+  void * address;
+  /** Size requested, the block size reported for it */
+  size_t size;
+  /** Bytes actually mapped */
+  size_t length;
+  /** 1 if the heap profiler sampled the block */
+  int sampled;
+};
+
+struct PersistentHeader;
+struct SharedHeader;
+
+/**
+*
+* \struct Arena
+*
+* \brief Everything that belongs to one arena
+*
+* A process has a default arena, used by every thread until it attaches to
+* the arena of its NUMA node with mavalloc_init_thread().  Every internal
+* function is handed the arena it works on; the public ones start from the
+* calling thread's, gCurrent, or for a block from the arena that owns it.
+*
+*/
+struct Arena
+{
+	/** Has the list been initialized */
+	int initialized;
+	/** First and last node of the ledger in address order, -1 if empty */
+	int head;
+	int tail;
+	/** Top of the stack of ledger entries not in use */
+	int free_slot;
+	/** Number of nodes in the ledger */
+	int node_count;
+	/** Highest ledger entry taken since the ledger was set up.  Freed entries
+	 *  are reused first, so every entry up to it is normally in use */
+	int high_water;
+	/** First and last hole in address order, -1 if there are none */
+	int hole_head;
+	int hole_tail;
+	enum ALGORITHM algorithm;
+	/** The placement policy actually used for the next allocation.  Equal to
+	 *  algorithm unless algorithm is ADAPTIVE */
+	enum ALGORITHM policy;
+	void * base;
+	long size;
+	/** The ledger.  Points at StaticLinkedList for the default arena, into
+	 *  the mapped file for persistent arenas and into the shared memory
+	 *  object for shared arenas */
+	struct Node * ledger;
+	/** The arena's own ledger, the one used when it is neither persistent
+	 *  nor shared */
+	struct Node * private_ledger;
+	/** Where the last NEXT_FIT search ended off on */
+	int next_fit_hole;
+	long leftover_size;
+	int search_length;
+
+	struct QuickEntry quick_list[QUICK_LIST_SIZE];
+	int quick_count;
+	int deferred_coalescing;
+
+	/** Offset of the application's root object, -1 if none has been set */
+	long root;
+
+	/** The mapping backing a persistent arena, NULL otherwise */
+	struct PersistentHeader * persistent;
+	size_t persistent_length;
+	int persistent_fd;
+
+	/** The shared memory object behind a shared arena, NULL if not shared */
+	struct SharedHeader * shared;
+	size_t shared_length;
+
+	struct HugeBlock huge_table[HUGE_TABLE_SIZE];
+	int huge_count;
+	/** 0 turns huge blocks off */
+	size_t huge_threshold;
+
+	int adaptive_window;
+	int adaptive_max_search;
+	int adaptive_max_fragmentation;
+	int window_allocations;
+	long window_search_length;
+	int window_failures;
+	size_t window_largest_request;
+
+	/** SEGREGATED serves requests below this from the low end of the arena
+	 *  and the rest from the high end */
+	size_t segregation_threshold;
+
+	/** Node the arena's pages are bound to, -1 if they are not bound */
+	int numa_node;
+	/** Length of the mapping base points at when the arena was mapped rather
+	 *  than malloc()ed, 0 otherwise */
+	size_t mapped_length;
+
+	/** 1 for a node arena, which the threads of its node share and every
+	 *  operation on takes lock, 0 for every other arena */
+	int thread_safe;
+	pthread_mutex_t lock;
+	/** Number of threads attached to a node arena */
+	int threads;
+};
+
+/* The members of a new arena that do not start out zero */
+#define ARENA_DEFAULTS                  \
+	.head = -1,                         \
+	.tail = -1,                         \
+	.free_slot = -1,                    \
+	.high_water = -1,                   \
+	.hole_head = -1,                    \
+	.hole_tail = -1,                    \
+	.root = -1,                         \
+	.persistent_fd = -1,                \
+	.adaptive_window = 256,             \
+	.adaptive_max_search = 64,          \
+	.adaptive_max_fragmentation = 50,   \
+	.segregation_threshold = 4096,      \
+	.numa_node = -1
+
+static const struct Arena EmptyArena = { ARENA_DEFAULTS };
+
+static struct Arena DefaultArena =
+{
+	ARENA_DEFAULTS,
+	.ledger = StaticLinkedList,
+	.private_ledger = StaticLinkedList
+};
+
+/* The arena the calling thread works on */
+static __thread struct Arena * gCurrent __attribute__(( tls_model( "initial-exec" ) )) = &DefaultArena;
+
+#define NUMA_MAX_NODES      1024
+
+/* The node arenas, indexed by node.  An entry is filled in once, by the
+ * first thread on the node to call mavalloc_init_thread(), and the arena then
+ * lives as long as the process.  node_arena_limit is one past the highest
+ * node that has one.
+ */
+static struct Arena * NodeArenas[NUMA_MAX_NODES];
+static int node_arena_limit = 0;
+
 
 /**
  *
- * \fn findFreeNodeInternal()
+ * \fn findFreeNodeInternal(struct Arena * arena)
  *
  * \brief Find a free array entry  *** INTERNAL USE ONLY ***
  *
- * Search the array to a free entry that we can use
- * to store a new node in the linked list.  Returns
- * the index of the free node or -1 is a node is not found.
+ * Take a free entry that we can use to store a new node in
+ * the linked list.  The free entries are kept on a stack linked
+ * through their next members, so this is a pop rather than a
+ * search.  Returns the index of the free node or -1 if a node
+ * is not found.
  * This function is for  *** INTERNAL USE ONLY ***.  We do not expose
  * the user to the fact that the linked list is in the array.
  * We're also not searching the list to find where this new node will
@@ -105,28 +302,46 @@ static struct Node LinkedList[MAX_LINKED_LIST_SIZE];
  * \return -1 on failure
  */
 
-int findFreeNodeInternal()
+int findFreeNodeInternal(struct Arena * arena)
 {
-	int i = 0;
+	int node = arena->free_slot;
 
-	/**
-	 *  Start searching the array beginning at the 0th element
-	 *  and once we've found an element not in use we'll drop out
-	 *  and return the index that is free.
-	*/
-	for (i = 0; i < MAX_LINKED_LIST_SIZE; i++)
+	if (node == -1)
+	{
+		return -1;
+	}
+	arena->free_slot = arena->ledger[node].next;
+	return node;
+}
+
+/**
+ *
+ * \fn rebuildFreeSlotsInternal(struct Arena * arena)
+ *
+ * \brief Put every array entry that is not in use on the free stack
+ *
+ * The lowest indexes end up on top so a fresh ledger fills the array
+ * from the front.
+ */
+static void rebuildFreeSlotsInternal( struct Arena * arena )
+{
+	int i;
+
+	arena->free_slot = -1;
+	for (i = MAX_LINKED_LIST_SIZE - 1; i >= 0; i--)
 	{
-		if (LinkedList[i].in_use == 0)
+		if (arena->ledger[i].in_use == 0)
 		{
-			return i;
+			arena->ledger[i].previous = -1;
+			arena->ledger[i].next = arena->free_slot;
+			arena->free_slot = i;
 		}
 	}
-	return -1;
 }
 
 /**
  *
- * \fn insertNodeInternal(int previous, int current)
+ * \fn insertNodeInternal(struct Arena * arena, int previous, long size)
  *
  * \brief Insert a new node in the list *** INTERNAL USE ONLY ***
  *
@@ -138,28 +353,24 @@ int findFreeNodeInternal()
  *
  * End Users should call insertNode( int node ) instead
  *
- * This function will insert the node located at "current" right
- * after the node indexed by "previous".
- *
- * We will shuffle every node after this spot one index along the array
- * and make a hole.
+ * This function takes a free array entry and links it into the
+ * list right after the node indexed by "previous", or at the
+ * front of the list if previous is -1.  No other node moves, the
+ * insertion only rewrites the links of its two neighbours.
  *
  *
  * \param previous  The index of the node that will be
  *                  previous to this node in the list
+ * \param size      The size stored in the new node
  *
  *
- * \return 0
+ * \return Array index of the new node on success
+ * \return -1 on failure
  */
-int insertNodeInternal(int previous, int size)
+int insertNodeInternal(struct Arena * arena, int previous, long size)
 {
-	int i = 0;
-
-	if (initialized && previous < 0 || previous >= MAX_LINKED_LIST_SIZE)
-	{
-		printf("ERROR: Tried to insert a node beyond our bounds %d\n", previous);
-		return -1;
-	}
+	int current;
+	int next;
 
 	/**
 	 * On the first node being inserted make sure that
@@ -167,46 +378,82 @@ int insertNodeInternal(int previous, int size)
 	 * set the initialized flag to we don't do this initialization
 	 * again.
 	 */
-	if (initialized == 0)
+	if (arena->initialized == 0)
 	{
 		int index = 0;
-		for (index = ROOTNODE; index < MAX_LINKED_LIST_SIZE; index++)
+		for (index = 0; index < MAX_LINKED_LIST_SIZE; index++)
 		{
-			LinkedList[index].in_use = 0;
+			arena->ledger[index].in_use = 0;
 		}
-		initialized = 1;
+		rebuildFreeSlotsInternal( arena );
+		arena->head = -1;
+		arena->tail = -1;
+		arena->node_count = 0;
+		arena->high_water = -1;
+		arena->initialized = 1;
+	}
+
+	if (previous < -1 || previous >= MAX_LINKED_LIST_SIZE ||
+		(previous != -1 && arena->ledger[previous].in_use == 0))
+	{
+		printf("ERROR: Tried to insert a node beyond our bounds %d\n", previous);
+		return -1;
+	}
+
+	/**
+	 * A full ledger is an ordinary out of memory condition the callers
+	 * handle, nothing to report.
+	 */
+	if ((current = findFreeNodeInternal( arena )) == -1)
+	{
+		return -1;
+	}
+
+	PROBE2( ledger_insert, previous, arena->node_count );
+
+	if (current > arena->high_water)
+	{
+		arena->high_water = current;
 	}
 
 	/**
-	 * Shift everything down and make room for the new node. But we only
-	 * need to shift from lastUsed to previous + 1
-	*/
-	if (lastUsed == -1)
+	 * Hook the new node up between previous and the node that
+	 * followed it.
+	 */
+	if (previous == -1)
 	{
-		LinkedList[i].size = size;
-		LinkedList[i].in_use = 1;
-		lastUsed = i;
+		next = arena->head;
+		arena->head = current;
 	}
 	else
 	{
-		for (i = 10; i >= previous; i--)
-		{
-			LinkedList[i + 1].size = LinkedList[i].size;
-			LinkedList[i + 1].in_use = LinkedList[i].in_use;
-		}
-	
-		LinkedList[previous].in_use = 1;
-		LinkedList[previous].size = size;
+		next = arena->ledger[previous].next;
+		arena->ledger[previous].next = current;
+	}
 
-		lastUsed++;
+	if (next == -1)
+	{
+		arena->tail = current;
+	}
+	else
+	{
+		arena->ledger[next].previous = current;
 	}
 
-	return 0;
+	arena->ledger[current].in_use = 1;
+	arena->ledger[current].sampled = 0;
+	arena->ledger[current].size = size;
+	arena->ledger[current].previous = previous;
+	arena->ledger[current].next = next;
+
+	arena->node_count++;
+
+	return current;
 }
 
 /**
  *
- * \fn removeNodeInternal(int node)
+ * \fn removeNodeInternal(struct Arena * arena, int node)
  *
  * \brief Remove a node in the list *** INTERNAL USE ONLY ***
  *
@@ -228,9 +475,10 @@ int insertNodeInternal(int previous, int size)
  * \return 0 on success
  * \return -1 on failure
  */
-int removeNodeInternal(int node)
+int removeNodeInternal(struct Arena * arena, int node)
 {
-	int i;
+	int previous;
+	int next;
 
 	/**
 	 * Check to make sure we haven't tried to insert a node beyond the bounds of
@@ -246,44 +494,55 @@ int removeNodeInternal(int node)
 	/**
 	 * And make sure that the node we've been asked to remove is actually one in use
 	 */
-	if (LinkedList[node].in_use == 0)
+	if (arena->ledger[node].in_use == 0)
 	{
 		printf("ERROR: Can not remove node %d.  It is not in use\n", node);
 		return -1;
 	}
 
-	/**
-	 * Mark this node as not in-use so we can reuse it if we need to allocate
-	 * another node.
-	 */
-	LinkedList[node].in_use = 0;
-
+	PROBE2( ledger_remove, node, arena->node_count );
 
 	/**
 	 * If we have a previous node then hook up the previous nodes next size
 	 * to point to our next size. That will cause our node to be snipped out
-	 * of the linked list.
+	 * of the linked list.  Likewise for the next node's previous.
 	 */
-	
-	for (i = node; i < lastUsed; i++)
-	{
-		LinkedList[i].size = LinkedList[i+1].size;
+	previous = arena->ledger[node].previous;
+	next = arena->ledger[node].next;
 
-		/* This line could be removed as it's not needed */
-		LinkedList[i].in_use = LinkedList[i + 1].in_use;
+	if (previous == -1)
+	{
+		arena->head = next;
+	}
+	else
+	{
+		arena->ledger[previous].next = next;
 	}
 
-	
+	if (next == -1)
+	{
+		arena->tail = previous;
+	}
+	else
+	{
+		arena->ledger[next].previous = previous;
+	}
 
 	/**
 	 * Return our next and previous to default sizes so this node is ready
-	 * be reused
+	 * be reused, and mark it as not in-use so we can reuse it if we need to
+	 * allocate another node.
 	 */
-	LinkedList[lastUsed].size = -1;
-	LinkedList[lastUsed].in_use = 0;
-
-	lastUsed = lastUsed - 1;
+	arena->ledger[node].size = -1;
+	arena->ledger[node].in_use = 0;
+	arena->ledger[node].sampled = 0;
+	arena->ledger[node].offset = 0;
+	arena->ledger[node].type = H;
+	arena->ledger[node].previous = -1;
+	arena->ledger[node].next = arena->free_slot;
+	arena->free_slot = node;
 
+	arena->node_count--;
 
 	return 0;
 }
@@ -293,48 +552,30 @@ int removeNodeInternal(int node)
  *
  * \fn removeNode(int node)
  *
- * \brief Remove a node from the linked list that contains the given size
+ * \brief Remove a node from the linked list
  *
  * This function will remove the node that is specified by the parameter
  * from the linked list.  This does not remove any data.  Only the next,
  * previous, and in_use flags are updated.
  *
- * \param size The size of the node that will be
+ * The node is identified by its index, never by its contents, several
+ * nodes may well hold the same size.
+ *
+ * \param node The index of the node that will be
  *              removed from the linked list
  *
  * \return 0 on success
  * \return -1 on failure
  */
-int removeNode(int size)
+int removeNode(int node)
 {
-	/**
-	  * We start searching for the node to remove at the root of the linked list
-	  */
-	int index = ROOTNODE;
-
-	/**
-	 * Iterate over the linked list and find the node
-	 * containing the size we are looking to remove
-	 */
-	while (index != -1)
-	{
-		/**
-		 * Once we've found the node to delete then
-		 * remove it.
-		 */
-		if (LinkedList[index].size == size)
-		{
-			return removeNodeInternal(index);
-		}
-		index++; 
-	}
-	return -1;
+	return removeNodeInternal(gCurrent, node);
 }
 
 
 /**
  *
- * \fn insertNode(int size)
+ * \fn insertNode(long size)
  *
  * \brief Insert a node into the linked list that contains the given size
  *
@@ -344,46 +585,31 @@ int removeNode(int size)
  * \param size The size of the node that will be
  *              inserted into the linked list
  *
- * \return 0 on success
+ * \return Array index of the new node on success
  * \return -1 on failure
  */
-int insertNode(int size)
+int insertNode(long size)
 {
+	/* The list of the calling thread's arena */
+	struct Arena * arena = gCurrent;
+
 	/*  Hold the index of the node we will insert behind */
 	int previous = -1;
 
-	/* Return size 0 for success. -1 for failure. */
-	int ret = -1;
-
 	/* Loop variable */
 	int i;
 
 	/**
 	 * Since this list is sorted, iterate over the linked list and find which node we  would
-	 * fit behind with our size.  Once we have found a spot then the while loop will exit
+	 * fit behind with our size.  Once we have found a spot then the loop will exit
 	 * and previous will have the index of the node we will insert behind.
 	 */
-	for (i = ROOTNODE; i < MAX_LINKED_LIST_SIZE; i++)
-	{
-		if ((LinkedList[i].in_use && LinkedList[i].size > size) ||
-			(LinkedList[i].in_use == 0))
-		{
-			previous = i;
-			break;
-		}
-	}
-
-	/** If we found a free node and we haven't run off the end of the list */
-	if (previous >= -1)
+	for (i = arena->head; i != -1 && arena->ledger[i].size <= size; i = arena->ledger[i].next)
 	{
-		ret = insertNodeInternal(previous, size);
+		previous = i;
 	}
-	else if (previous >= MAX_LINKED_LIST_SIZE || previous < 0)
-	{
-		printf("Error: Tried to insert beyond the bounds of the allocated list.\n");
 
-	}
-	return ret;
+	return insertNodeInternal(arena, previous, size);
 }
 
 /**
@@ -396,353 +622,702 @@ int insertNode(int size)
  * If you need a function to iterate over the linked list in order, this is
  * how you would do that.
  *
- * Since the array is kept in sorted order, iterating in order over the array
- * iterates in order.
- *
  */
 void printList()
 {
+	struct Arena * arena = gCurrent;
+
 	/** Start at the root of the linked list */
 	int i = 0;
 
 	/** Iterate over the linked list in node order and print the nodes. */
 
-	for (i = ROOTNODE; i < MAX_LINKED_LIST_SIZE; i++)
+	for (i = arena->head; i != -1; i = arena->ledger[i].next)
 	{
-		if (LinkedList[i].in_use == 0)
-		{
-			/** This array is not sparse so the first entry which has a 0 size for
-			 *  in-use means we've reached the end so no need to continue the loop
-			 */
-			break;
-		}
 		//printf("LinkedList[%d]: %d\n", i, LinkedList[i].size);
-    printf("LinkedList[%d].size = %d\n", i, LinkedList[i].size);
-    printf("LinkedList[%d].type = %d\n", i, LinkedList[i].type);
-    printf("LinkedList[%d].arena = %p\n", i, LinkedList[i].arena);
-    printf("LinkedList[%d].in_use = %d\n", i, LinkedList[i].in_use);
+    printf("LinkedList[%d].size = %ld\n", i, arena->ledger[i].size);
+    printf("LinkedList[%d].type = %d\n", i, arena->ledger[i].type);
+    printf("LinkedList[%d].offset = %zu\n", i, arena->ledger[i].offset);
+    printf("LinkedList[%d].in_use = %d\n", i, arena->ledger[i].in_use);
 	}
 }
 
 void addList()
 {
+	struct Arena * arena = gCurrent;
+
 	/** Start at the root of the linked list */
 	int i = 0;
-  int sum = 0;
+  long sum = 0;
 
 	/** Iterate over the linked list in node order and print the nodes. */
 
-	for (i = ROOTNODE; i < MAX_LINKED_LIST_SIZE; i++)
+	for (i = arena->head; i != -1; i = arena->ledger[i].next)
 	{
-		if (LinkedList[i].in_use == 0)
-		{
-			/** This array is not sparse so the first entry which has a 0 size for
-			 *  in-use means we've reached the end so no need to continue the loop
-			 */
-			break;
-		}
-    sum += LinkedList[i].size;
+    sum += arena->ledger[i].size;
 		//printf("LinkedList[%d]: %d\n", i, LinkedList[i].size);
-    printf("LinkedList[%d].size = %d\n", i, LinkedList[i].size);
-    printf("LinkedList[%d].type = %d\n", i, LinkedList[i].type);
-    printf("LinkedList[%d].arena = %p\n", i, LinkedList[i].arena);
-    printf("LinkedList[%d].in_use = %d\n", i, LinkedList[i].in_use);
+    printf("LinkedList[%d].size = %ld\n", i, arena->ledger[i].size);
+    printf("LinkedList[%d].type = %d\n", i, arena->ledger[i].type);
+    printf("LinkedList[%d].offset = %zu\n", i, arena->ledger[i].offset);
+    printf("LinkedList[%d].in_use = %d\n", i, arena->ledger[i].in_use);
 	}
-  printf("Total size = %d\n", sum);
+  printf("Total size = %ld\n", sum);
 }
 
 
 int spitSum()
 {
+	struct Arena * arena = gCurrent;
+
   /** Start at the root of the linked list */
 	int i = 0;
-  int sum = 0;
+  long sum = 0;
 
 	/** Iterate over the linked list in node order and print the nodes. */
 
-	for (i = ROOTNODE; i < MAX_LINKED_LIST_SIZE; i++)
+	for (i = arena->head; i != -1; i = arena->ledger[i].next)
 	{
-		if (LinkedList[i].in_use == 0)
-		{
-			/** This array is not sparse so the first entry which has a 0 size for
-			 *  in-use means we've reached the end so no need to continue the loop
-			 */
-			break;
-		}
-    sum += LinkedList[i].size;
+    sum += arena->ledger[i].size;
 		//printf("LinkedList[%d]: %d\n", i, LinkedList[i].size);
 	}
   return sum;
 }
 
-int global_size = 0;
-int mavalloc_init( size_t size, enum ALGORITHM algorithm )
-{
-  // set the algorithm type // initialize the allocation arena
+/* The holes.  Every hole is also on a second list, in address order, threaded
+ * through previous_hole and next_hole, so placement searches step from hole
+ * to hole and never look at an allocated block.  The helpers below keep
+ * NEXT_FIT's cursor on a hole: when its hole goes away the cursor moves to
+ * the hole that takes its place or follows it.
+ */
 
+/**
+ *
+ * \fn linkHoleInternal(struct Arena * arena, int hole, int previous_hole)
+ *
+ * \brief Put the hole on the hole list right after previous_hole, or at the
+ *        front if previous_hole is -1
+ */
+static void linkHoleInternal( struct Arena * arena, int hole, int previous_hole )
+{
+  int next_hole = previous_hole == -1 ? arena->hole_head : arena->ledger[previous_hole].next_hole;
 
-  // initialize the linked list
-  int i = 0;
-  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++)
+  arena->ledger[hole].previous_hole = previous_hole;
+  arena->ledger[hole].next_hole = next_hole;
+  if( previous_hole == -1 )
   {
-    LinkedList[i].size = 0;
-    LinkedList[i].in_use = 0;
-    LinkedList[i].arena = 0;
-    LinkedList[i].type = H;
+    arena->hole_head = hole;
   }
-  // size must be 4-byte aligned
-    // Use the macro ALIGN4 to perform this alignment
-    // take the size and call malloc
-        // allocate a memory arena 
-            //preallocate the memory for your ledger
-            // assume a maximum of 10,000 allocations
-        // this is the only malloc() your code will call
-  // allocate the pool
-  gArena = malloc( ALIGN4( size ) );
-  //printf("\ngArena = %p", gArena);
-  //printf("%p\n", gArena);
+  else
+  {
+    arena->ledger[previous_hole].next_hole = hole;
+  }
+  if( next_hole == -1 )
+  {
+    arena->hole_tail = hole;
+  }
+  else
+  {
+    arena->ledger[next_hole].previous_hole = hole;
+  }
+}
 
-  // save the algorithm type
-  gAlgorithm = algorithm;
+/**
+ *
+ * \fn unlinkHoleInternal(struct Arena * arena, int hole)
+ *
+ * \brief Take the hole off the hole list
+ */
+static void unlinkHoleInternal( struct Arena * arena, int hole )
+{
+  int previous_hole = arena->ledger[hole].previous_hole;
+  int next_hole = arena->ledger[hole].next_hole;
 
-  // set the first entry to point to the area
-  LinkedList[0].in_use = 1;
-  LinkedList[0].size = ALIGN4( size );
-  global_size = ALIGN4(size);
-  LinkedList[0].type = H;
-  LinkedList[0].arena = gArena;
-
-  /*
-  printf("\n--After Initialization--");
-  printf("\nLinkedList[%d].size = %d", 0, LinkedList[0].size);
-  printf("\nLinkedList[%d].type = %d", 0, LinkedList[0].type);
-  printf("\nLinkedList[%d].arena = %p", 0, LinkedList[0].arena);
-  printf("\nLinkedList[%d].in_use = %d", 0, LinkedList[0].in_use);
-  */
-
- // if the allocation fails
-        // return -1
-  
-// if the allocations succeed
-        //  return 0
-  
-  return 0;
+  if( previous_hole == -1 )
+  {
+    arena->hole_head = next_hole;
+  }
+  else
+  {
+    arena->ledger[previous_hole].next_hole = next_hole;
+  }
+  if( next_hole == -1 )
+  {
+    arena->hole_tail = previous_hole;
+  }
+  else
+  {
+    arena->ledger[next_hole].previous_hole = previous_hole;
+  }
+  if( arena->next_fit_hole == hole )
+  {
+    arena->next_fit_hole = next_hole;
+  }
 }
 
-void mavalloc_destroy( )
+/**
+ *
+ * \fn replaceHoleInternal(struct Arena * arena, int hole, int replacement)
+ *
+ * \brief Put replacement on the hole list in the place of hole
+ *
+ * Only valid when no other hole lies between the two in address order.
+ */
+static void replaceHoleInternal( struct Arena * arena, int hole, int replacement )
 {
-  // Destory the arena
-    // This function releases the arena
-  int i = 0;
-  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++)
+  int cursor = arena->next_fit_hole;
+
+  linkHoleInternal( arena, replacement, arena->ledger[hole].previous_hole );
+  unlinkHoleInternal( arena, hole );
+  if( cursor == hole )
   {
-    LinkedList[i].size = 0;
-    LinkedList[i].in_use = 0;
-    LinkedList[i].arena = 0;
-    LinkedList[i].type = H;
+    arena->next_fit_hole = replacement;
   }
-
-  free( gArena );
-  return;
 }
 
-/*
-          printf("\n\n--After block insertion--");
-          printf("\nLinkedList[%d].size = %d", i, LinkedList[i].size);
-          printf("\nLinkedList[%d].type = %d", i, LinkedList[i].type);
-          printf("\nLinkedList[%d].arena = %p", i, LinkedList[i].arena);
-          printf("\nLinkedList[%d].in_use = %d", i, LinkedList[i].in_use);
-          printf("\n\nLinkedList[%d].size = %d", i+1, LinkedList[i+1].size);
-          printf("\nLinkedList[%d].type = %d", i+1, LinkedList[i+1].type);
-          printf("\nLinkedList[%d].arena = %p", i+1, LinkedList[i+1].arena);
-          printf("\nLinkedList[%d].in_use = %d", i+1, LinkedList[i+1].in_use);
-          */
-
-// initialize global variable for NEXT_FIT
-// will remember where the last search ended off on
-int previously_allocated_hole = 0;
-
-// initialize leftover_size globally
-int leftover_size = 0;
-void * mavalloc_alloc( size_t size )
+/**
+ *
+ * \fn rebuildHolesInternal(struct Arena * arena)
+ *
+ * \brief Thread every hole in the ledger onto the hole list
+ */
+static void rebuildHolesInternal( struct Arena * arena )
 {
-  //Allocate memory from the arena
+  int i;
 
-    // Size specifies the number of bytes to allocate
-        // must use the ALIGN4 macro
-  // allocate size
-  void * ptr = NULL;
-  size_t new_size = ALIGN4(size);
-  
-  // If there is an available block of memory
-        // return a pointer to the available memory
-  if( gAlgorithm == FIRST_FIT )
+  arena->hole_head = -1;
+  arena->hole_tail = -1;
+  for( i = arena->head; i != -1; i = arena->ledger[i].next )
   {
-    //printf("\nFIRST_FIT\n");
-    // Allocate the first hole that is big enough
-    // the first search starts at the beginning of the list
-    // Allocate the first hole that is big enough
-    // start at the beginning of the list
-    int i = 0;
-    // if the node type is hole and in_use and size < node size
-    for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+    if( arena->ledger[i].type == H )
     {
-      if( LinkedList[i].type == H && LinkedList[i].in_use && new_size <= LinkedList[i].size )
-      {
-        leftover_size = LinkedList[i].size - new_size;
-
-        // Calculate the new arena pointer
-        void * arena = (void*)((long int)LinkedList[i].arena);
-      //    if there is leftover size then insert a new node as
-      //      a hole that holds that leftover space
-      //      insertNode( leftover_size, arena );
-        if(leftover_size > 0)
-        {
-          insertNode( new_size );
-          LinkedList[i].type = P;
-          LinkedList[i].arena = arena;
-
-          LinkedList[i+1].size = leftover_size;
-          LinkedList[i+1].type = H;
-          LinkedList[i+1].arena = arena+(long int)new_size;
-        }
-        else
-        {
-          LinkedList[i].size = new_size;
-          LinkedList[i].type = P;
-          LinkedList[i].arena = arena;
-        }
-        return LinkedList[i].arena;
-      }
+      linkHoleInternal( arena, i, arena->hole_tail );
     }
   }
-  // start search from last allocated hole
-    // resume from the point of the list that the last search ended on
-  
-  else if( gAlgorithm == NEXT_FIT )
+}
+
+/**
+ *
+ * \fn loadLedgerInternal(struct Arena * arena)
+ *
+ * \brief Set up the list state for the nodes already in the ledger
+ *
+ * Finds the first and last node, counts the nodes, threads the hole list and
+ * puts every entry not in use on the free stack.  Used for fresh ledgers and
+ * for ledgers read back from a file or shared memory, which only hold the
+ * nodes.
+ */
+static void loadLedgerInternal( struct Arena * arena )
+{
+  int i;
+
+  arena->head = -1;
+  arena->tail = -1;
+  arena->node_count = 0;
+  arena->high_water = -1;
+  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
   {
-    
-    
-    // Allocate the first hole that is big enough
-    // start at the beginning of the list
-    //previously_allocated_hole
-      // initialized globally above mavalloc_alloc()
-    // if the node type is hole and in_use and size < node size
-    int run = 1;
-    int i = previously_allocated_hole;
-    // Calculate the new arena pointer
-    void * arena = (void*)((long int)LinkedList[i].arena);
-    while( run == 1)
+    if( !arena->ledger[i].in_use )
     {
-      
-      if( LinkedList[i].type == H && LinkedList[i].in_use && new_size <= LinkedList[i].size )
-      {
-        leftover_size = LinkedList[i].size - new_size;
-        
-        
-      //    if there is leftover size then insert a new node as
-      //      a hole that holds that leftover space
-      //      insertNode( leftover_size );
-        if(leftover_size > 0)
-        {
-          
-          insertNode( new_size );
-          LinkedList[i].type = P;
-          LinkedList[i].arena = arena;
-
-          //insertNode( leftover_size);
-          LinkedList[i+1].size = leftover_size;
-          LinkedList[i+1].type = H;
-          LinkedList[i+1].arena = arena+(long int)new_size;
-        }
-        else
-        {
-          
-          LinkedList[i].size = new_size;
-          LinkedList[i].type = P;
-          LinkedList[i].arena = arena;
-        }
-        return LinkedList[i].arena;
-      }
-      i++;
-      if( i == MAX_LINKED_LIST_SIZE)
-      {
-        i = 0;
-      }
-      if( i == previously_allocated_hole)
-      {
-        run = 0;
-      }
+      continue;
     }
-  }
-    
-  else if( gAlgorithm == BEST_FIT )
-  {
+    arena->node_count++;
+    arena->high_water = i;
+    if( arena->ledger[i].previous == -1 )
+    {
+      arena->head = i;
+    }
+    if( arena->ledger[i].next == -1 )
+    {
+      arena->tail = i;
+    }
+  }
+  rebuildFreeSlotsInternal( arena );
+  rebuildHolesInternal( arena );
+  arena->initialized = 1;
+  arena->next_fit_hole = arena->hole_head;
+}
+
+/**
+ *
+ * \fn resetLedgerInternal(struct Arena * arena, long size)
+ *
+ * \brief Make the ledger a single hole covering an arena of size bytes
+ */
+static void resetLedgerInternal( struct Arena * arena, long size )
+{
+  int i = 0;
+  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++)
+  {
+    arena->ledger[i].size = 0;
+    arena->ledger[i].in_use = 0;
+    arena->ledger[i].sampled = 0;
+    arena->ledger[i].offset = 0;
+    arena->ledger[i].type = H;
+  }
+
+  // set the first entry to point to the area
+  arena->ledger[0].in_use = 1;
+  arena->ledger[0].size = size;
+  arena->ledger[0].type = H;
+  arena->ledger[0].offset = 0;
+  arena->ledger[0].previous = -1;
+  arena->ledger[0].next = -1;
+  arena->size = size;
+
+  // the ledger now holds exactly one node, the hole covering the arena
+  loadLedgerInternal( arena );
+  arena->quick_count = 0;
+  arena->root = -1;
+}
+
+/* Huge blocks.  Requests of at least huge_threshold bytes get their own
+ * anonymous mapping instead of a slice of the arena, so a giant buffer never
+ * takes a ledger entry or leaves a giant hole behind.  The mappings are kept
+ * in a small open addressed hash table keyed by address, so finding one is
+ * constant time whatever the size of the ledger.  Only private arenas use
+ * them, a persistent or shared arena must hold every block itself.
+ */
+
+// mmap returns page aligned addresses, anything else is not a huge block
+#define HUGE_ALIGNMENT    4096
+
+static int hugeHomeInternal( void * ptr )
+{
+  return ( ( (uintptr_t)ptr / HUGE_ALIGNMENT ) * 0x9E3779B97F4A7C15ull >> 32 ) &
+         ( HUGE_TABLE_SIZE - 1 );
+}
+
+/**
+ *
+ * \fn findHugeInternal(struct Arena * arena, void * ptr)
+ *
+ * \brief Find the table slot of the huge block starting at ptr
+ *
+ * \return The slot on success
+ * \return -1 if ptr is not a huge block
+ */
+static int findHugeInternal( struct Arena * arena, void * ptr )
+{
+  int slot;
+
+  if( arena->huge_count == 0 || ( (uintptr_t)ptr & ( HUGE_ALIGNMENT - 1 ) ) != 0 )
+  {
+    return -1;
+  }
+
+  for( slot = hugeHomeInternal( ptr ); arena->huge_table[slot].address != NULL;
+       slot = ( slot + 1 ) & ( HUGE_TABLE_SIZE - 1 ) )
+  {
+    if( arena->huge_table[slot].address == ptr )
+    {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+static void insertHugeInternal( struct Arena * arena, void * address, size_t size, size_t length )
+{
+  int slot = hugeHomeInternal( address );
+
+  while( arena->huge_table[slot].address != NULL )
+  {
+    slot = ( slot + 1 ) & ( HUGE_TABLE_SIZE - 1 );
+  }
+  arena->huge_table[slot].address = address;
+  arena->huge_table[slot].size = size;
+  arena->huge_table[slot].length = length;
+  arena->huge_table[slot].sampled = 0;
+  arena->huge_count++;
+}
+
+/**
+ *
+ * \fn removeHugeInternal(struct Arena * arena, int slot)
+ *
+ * \brief Empty a table slot
+ *
+ * Later entries of the same probe run are shifted back into the gap, so
+ * lookups never need tombstones.
+ */
+static void removeHugeInternal( struct Arena * arena, int slot )
+{
+  int next = ( slot + 1 ) & ( HUGE_TABLE_SIZE - 1 );
+
+  while( arena->huge_table[next].address != NULL )
+  {
+    int home = hugeHomeInternal( arena->huge_table[next].address );
+
+    // the entry may fill the gap if the gap lies between its home and it
+    if( ( ( next - home ) & ( HUGE_TABLE_SIZE - 1 ) ) >=
+        ( ( next - slot ) & ( HUGE_TABLE_SIZE - 1 ) ) )
+    {
+      arena->huge_table[slot] = arena->huge_table[next];
+      slot = next;
+    }
+    next = ( next + 1 ) & ( HUGE_TABLE_SIZE - 1 );
+  }
+  arena->huge_table[slot].address = NULL;
+  arena->huge_count--;
+}
+
+static void * hugeAllocInternal( struct Arena * arena, size_t size )
+{
+  size_t length = ( size + HUGE_ALIGNMENT - 1 ) & ~( (size_t)HUGE_ALIGNMENT - 1 );
+  void * address;
+
+  if( arena->huge_count >= HUGE_TABLE_LIMIT )
+  {
+    return NULL;
+  }
+
+  address = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( address == MAP_FAILED )
+  {
+    return NULL;
+  }
+  insertHugeInternal( arena, address, size, length );
+  return address;
+}
+
+static void releaseHugeBlocksInternal( struct Arena * arena )
+{
+  int slot;
+
+  for( slot = 0; slot < HUGE_TABLE_SIZE; slot++ )
+  {
+    if( arena->huge_table[slot].address != NULL )
+    {
+      munmap( arena->huge_table[slot].address, arena->huge_table[slot].length );
+      arena->huge_table[slot].address = NULL;
+    }
+  }
+  arena->huge_count = 0;
+}
+
+static struct Arena * processArenaInternal( );
+static void detachThreadInternal( );
+static int lockArenaInternal( struct Arena * arena );
+static void unlockArenaInternal( struct Arena * arena );
+static void setAlgorithmInternal( struct Arena * arena, enum ALGORITHM algorithm );
+
+int mavalloc_init( size_t size, enum ALGORITHM algorithm )
+{
+  // set the algorithm type // initialize the allocation arena
+  struct Arena * arena = processArenaInternal( );
+
+  // initialize the linked list
+  arena->ledger = arena->private_ledger;
+
+  // size must be 4-byte aligned
+    // Use the macro ALIGN4 to perform this alignment
+    // take the size and call malloc
+        // allocate a memory arena 
+            //preallocate the memory for your ledger
+            // assume a maximum of 10,000 allocations
+        // this is the only malloc() your code will call
+  // allocate the pool
+  arena->base = malloc( ALIGN4( size ) );
+
+  // if the allocation fails
+        // return -1
+  if( arena->base == NULL )
+  {
+    return -1;
+  }
+
+  // save the algorithm type
+  setAlgorithmInternal( arena, algorithm );
+
+  resetLedgerInternal( arena, ALIGN4( size ) );
+
+// if the allocations succeed
+        //  return 0
+  
+  return 0;
+}
+
+void mavalloc_destroy( )
+{
+  // Destory the arena
+    // This function releases the arena
+  struct Arena * arena = gCurrent;
+  int i = 0;
+
+  // a node arena stays for the other threads of the node and the blocks
+  // still in it, the thread only lets go of it
+  if( arena->thread_safe )
+  {
+    detachThreadInternal( );
+    return;
+  }
+
+  // a persistent arena is checkpointed and unmapped, its ledger stays in
+  // the file
+  if( arena->persistent != NULL )
+  {
+    mavalloc_sync( );
+    munmap( arena->persistent, arena->persistent_length );
+    close( arena->persistent_fd );
+    arena->persistent = NULL;
+    arena->persistent_fd = -1;
+    arena->base = NULL;
+    arena->ledger = arena->private_ledger;
+  }
+
+  // a shared arena is only detached, the other processes keep using it
+  if( arena->shared != NULL )
+  {
+    munmap( arena->shared, arena->shared_length );
+    arena->shared = NULL;
+    arena->base = NULL;
+    arena->ledger = arena->private_ledger;
+  }
+
+  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++)
+  {
+    arena->ledger[i].size = 0;
+    arena->ledger[i].in_use = 0;
+    arena->ledger[i].offset = 0;
+    arena->ledger[i].type = H;
+  }
+
+  rebuildFreeSlotsInternal( arena );
+  arena->head = -1;
+  arena->tail = -1;
+  arena->node_count = 0;
+  arena->high_water = -1;
+  arena->hole_head = -1;
+  arena->hole_tail = -1;
+  arena->next_fit_hole = -1;
+  arena->quick_count = 0;
+  arena->root = -1;
+
+  releaseHugeBlocksInternal( arena );
+
+  if( arena->mapped_length != 0 )
+  {
+    munmap( arena->base, arena->mapped_length );
+    arena->mapped_length = 0;
+    arena->numa_node = -1;
+  }
+  else
+  {
+    free( arena->base );
+  }
+  arena->base = NULL;
+  return;
+}
+
+/**
+ *
+ * \fn allocateHoleInternal(struct Arena * arena, int hole, size_t size)
+ *
+ * \brief Hand out the front of the hole at ledger index "hole"
+ *
+ * Turns the hole into an allocated block of the requested size.  If the hole
+ * is bigger than the request a new node is linked in right behind the block
+ * to hold the leftover space.
+ *
+ * \return Pointer to the allocated block, NULL if the ledger is full
+ */
+static void * allocateHoleInternal( struct Arena * arena, int hole, size_t size )
+{
+  size_t offset = arena->ledger[hole].offset;
+
+  arena->leftover_size = arena->ledger[hole].size - size;
+
+  //    if there is leftover size then insert a new node as
+  //      a hole that holds that leftover space
+  if( arena->leftover_size > 0 )
+  {
+    int rest;
+
+    // a full ledger is an ordinary out of memory condition, not an error
+    if( arena->node_count >= MAX_LINKED_LIST_SIZE ||
+        ( rest = insertNodeInternal( arena, hole, arena->leftover_size ) ) == -1 )
+    {
+      return NULL;
+    }
+    arena->ledger[hole].size = size;
+    arena->ledger[hole].type = P;
+    arena->ledger[hole].offset = offset;
+
+    arena->ledger[rest].type = H;
+    arena->ledger[rest].offset = offset + size;
+    replaceHoleInternal( arena, hole, rest );
+  }
+  else
+  {
+    arena->ledger[hole].size = size;
+    arena->ledger[hole].type = P;
+    arena->ledger[hole].offset = offset;
+    unlinkHoleInternal( arena, hole );
+  }
+  return (char *)arena->base + offset;
+}
+
+/**
+ *
+ * \fn allocateHoleTopInternal(struct Arena * arena, int hole, size_t size)
+ *
+ * \brief Hand out the back of the hole at ledger index "hole"
+ *
+ * The mirror image of allocateHoleInternal: the hole keeps its start and
+ * shrinks, the block is linked in right behind it at the top of the space.
+ *
+ * \return Pointer to the allocated block, NULL if the ledger is full
+ */
+static void * allocateHoleTopInternal( struct Arena * arena, int hole, size_t size )
+{
+  size_t offset;
+  int block;
+
+  arena->leftover_size = arena->ledger[hole].size - size;
+  if( arena->leftover_size == 0 )
+  {
+    return allocateHoleInternal( arena, hole, size );
+  }
+
+  if( arena->node_count >= MAX_LINKED_LIST_SIZE ||
+      ( block = insertNodeInternal( arena, hole, size ) ) == -1 )
+  {
+    return NULL;
+  }
+  offset = arena->ledger[hole].offset + arena->leftover_size;
+  arena->ledger[hole].size = arena->leftover_size;
+
+  arena->ledger[block].type = P;
+  arena->ledger[block].offset = offset;
+  return (char *)arena->base + offset;
+}
+
+/* The allocation path is written once and inlined into a copy per placement
+ * policy.  Called with a constant policy every test of it folds away and the
+ * copy holds only that policy's search loop.
+ */
+#define ALWAYS_INLINE inline __attribute__(( always_inline ))
+
+/**
+ *
+ * \fn allocInternal(struct Arena * arena, size_t new_size, enum ALGORITHM algorithm)
+ *
+ * \brief Place an already aligned request using the given policy
+ *
+ * \return Pointer to the allocated block, NULL if nothing fits
+ */
+static ALWAYS_INLINE void * allocInternal( struct Arena * arena, size_t new_size,
+                                           enum ALGORITHM algorithm )
+{
+  arena->search_length = 0;
+
+  // If there is an available block of memory
+        // return a pointer to the available memory
+  if( algorithm == FIRST_FIT )
+  {
+    // Allocate the first hole that is big enough
+    // start at the beginning of the list
+    int i = 0;
+    // if the hole's size >= the requested size
+    for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
+    {
+      arena->search_length++;
+      if( new_size <= (size_t)arena->ledger[i].size )
+      {
+        return allocateHoleInternal( arena, i, new_size );
+      }
+    }
+  }
+  // start search from last allocated hole
+    // resume from the point of the list that the last search ended on
+  
+  else if( algorithm == NEXT_FIT )
+  {
+    // Allocate the first hole that is big enough
+    // starting where the previous search left off
+    //arena->next_fit_hole
+      // initialized globally above mavalloc_alloc()
+    // if the hole's size >= the requested size
+    int run = 1;
+    int i;
+
+    if( arena->next_fit_hole < 0 || arena->next_fit_hole >= MAX_LINKED_LIST_SIZE ||
+        !arena->ledger[arena->next_fit_hole].in_use ||
+        arena->ledger[arena->next_fit_hole].type != H )
+    {
+      arena->next_fit_hole = arena->hole_head;
+    }
+    i = arena->next_fit_hole;
+    if( i == -1 )
+    {
+      run = 0;
+    }
+
+    while( run == 1)
+    {
+      arena->search_length++;
+      if( new_size <= (size_t)arena->ledger[i].size )
+      {
+        // the cursor moves on to the leftover space or the next hole
+        arena->next_fit_hole = i;
+        return allocateHoleInternal( arena, i, new_size );
+      }
+      i = arena->ledger[i].next_hole;
+      if( i == -1 )
+      {
+        i = arena->hole_head;
+      }
+      if( i == arena->next_fit_hole)
+      {
+        run = 0;
+      }
+    }
+  }
     
+  else if( algorithm == BEST_FIT )
+  {
     // allocate the smallest hole that is big enough
     // start at the beginning of th list
     int i = 0;
 
-    // marker to find the largest hole
+    // marker to find the smallest hole
     int smallest_hole = -1;
 
-    // tracker of previously largest hole
-    //INT_MIN?
-    int previously_smallest_leftover_size = -1;
-
-    // Calculate the new arena pointer
-    void * arena = (void*)((long int)LinkedList[i].arena);
+    // tracker of previously smallest hole
+    long previously_smallest_leftover_size = -1;
 
-    // if the node type is hole and in_use and size < node size
-    for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+    // if the hole's size >= the requested size
+    for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
     {
-      if( LinkedList[i].type == H && LinkedList[i].in_use && new_size <= LinkedList[i].size )
+      arena->search_length++;
+      if( new_size <= (size_t)arena->ledger[i].size )
       {
         //calculate if the hole is big enough
-        leftover_size = LinkedList[i].size - new_size;
+        arena->leftover_size = arena->ledger[i].size - new_size;
 
-        
         // compare the size of the hole to the previous hole
-        // if the leftover_size is larger than the previously largest leftover_size
+        // if the leftover_size is smaller than the previously smallest leftover_size
           // then no longer consider the previous hole
-        if(leftover_size < previously_smallest_leftover_size || previously_smallest_leftover_size == -1)
+        if(arena->leftover_size < previously_smallest_leftover_size ||
+           previously_smallest_leftover_size == -1)
         {
           smallest_hole = i;
-          previously_smallest_leftover_size = leftover_size;          
+          previously_smallest_leftover_size = arena->leftover_size;          
         }
       }
     }
 
-    // if largest_hole != -1
-    // then split if leftoversize > 0
-    // set linkedlist[winner].type - p
-    // return linked list[i].arena
+    // if smallest_hole != -1
+    // then split the winner and return its arena
     if(smallest_hole != -1)
     {
-      if(leftover_size > 0)
-      {
-        insertNode( new_size );
-        LinkedList[smallest_hole].type = P;
-        LinkedList[smallest_hole].arena = arena;
-
-        LinkedList[smallest_hole+1].size = leftover_size;
-        LinkedList[smallest_hole+1].type = H;
-        LinkedList[smallest_hole+1].arena = arena+(long int)new_size;
-      }
-      else
-      {
-        LinkedList[smallest_hole].size = new_size;
-        LinkedList[smallest_hole].type = P;
-        LinkedList[smallest_hole].arena = arena;
-      }
-      return LinkedList[smallest_hole].arena;
+      return allocateHoleInternal( arena, smallest_hole, new_size );
     }
   }
 
-  else if( gAlgorithm == WORST_FIT )
+  else if( algorithm == WORST_FIT )
   {
-    
-    // allocate the smallest hole that is big enough
+    // allocate the largest hole that is big enough
     // start at the beginning of th list
     int i = 0;
 
@@ -750,55 +1325,64 @@ void * mavalloc_alloc( size_t size )
     int largest_hole = -1;
 
     // tracker of previously largest hole
-    //INT_MIN?
-    int previously_largest_leftover_size = -1000;
-
-    // Calculate the new arena pointer
-    void * arena = (void*)((long int)LinkedList[i].arena);
+    long previously_largest_leftover_size = -1;
 
-    // if the node type is hole and in_use and size < node size
-    for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+    // if the hole's size >= the requested size
+    for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
     {
-      if( LinkedList[i].type == H && LinkedList[i].in_use && new_size <= LinkedList[i].size )
+      arena->search_length++;
+      if( new_size <= (size_t)arena->ledger[i].size )
       {
         //calculate if the hole is big enough
-        leftover_size = LinkedList[i].size - new_size;
+        arena->leftover_size = arena->ledger[i].size - new_size;
 
-        
         // compare the size of the hole to the previous hole
         // if the leftover_size is larger than the previously largest leftover_size
           // then no longer consider the previous hole
-        if(leftover_size > previously_largest_leftover_size)
+        if(arena->leftover_size > previously_largest_leftover_size)
         {
           largest_hole = i;
-          previously_largest_leftover_size = leftover_size;          
+          previously_largest_leftover_size = arena->leftover_size;          
         }
       }
     }
 
     // if largest_hole != -1
-    // then split if leftoversize > 0
-    // set linkedlist[winner].type - p
-    // return linked list[i].arena
+    // then split the winner and return its arena
     if(largest_hole != -1)
     {
-      if(leftover_size > 0)
-      {
-        insertNode( new_size );
-        LinkedList[largest_hole].type = P;
-        LinkedList[largest_hole].arena = arena;
+      return allocateHoleInternal( arena, largest_hole, new_size );
+    }
+  }
+
+  else if( algorithm == SEGREGATED )
+  {
+    // small requests take the lowest hole that fits and large ones the
+    // highest, cut from its top, so each size class packs against its own
+    // end of the arena and the free space between them stays in one piece
+    int i;
 
-        LinkedList[largest_hole+1].size = leftover_size;
-        LinkedList[largest_hole+1].type = H;
-        LinkedList[largest_hole+1].arena = arena+(long int)new_size;
+    if( new_size < arena->segregation_threshold )
+    {
+      for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
+      {
+        arena->search_length++;
+        if( new_size <= (size_t)arena->ledger[i].size )
+        {
+          return allocateHoleInternal( arena, i, new_size );
+        }
       }
-      else
+    }
+    else
+    {
+      for( i = arena->hole_tail; i != -1; i = arena->ledger[i].previous_hole )
       {
-        LinkedList[largest_hole].size = new_size;
-        LinkedList[largest_hole].type = P;
-        LinkedList[largest_hole].arena = arena;
+        arena->search_length++;
+        if( new_size <= (size_t)arena->ledger[i].size )
+        {
+          return allocateHoleTopInternal( arena, i, new_size );
+        }
       }
-      return LinkedList[largest_hole].arena;
     }
   }
   // If there is no available block of memory
@@ -807,69 +1391,2340 @@ void * mavalloc_alloc( size_t size )
   return NULL;
 }
 
-void mavalloc_free( void * ptr )
+/**
+ *
+ * \fn topBlockInternal(struct Arena * arena)
+ *
+ * \brief Ledger index of the last node below the trailing hole
+ *
+ * This is the top of the used region, where the most recent allocation sits
+ * while allocations and frees nest.  It is -1 if the arena is one hole.
+ */
+static int topBlockInternal( struct Arena * arena )
 {
-  // free the pointer passed in
-        // the pointer is of the heap memory
-    
-    // free the memory block pointed to by the pointer
-    // if the block is adjacent to another block then combine them (coalesce)
+  int top = arena->tail;
 
-    // return none
+  if( top != -1 && arena->ledger[top].type == H )
+  {
+    top = arena->ledger[top].previous;
+  }
+  return top;
+}
 
-  // maybe ALIGN4 the ptr size???
-  
-  // search for the node containing the value given by ptr
-  // set that node to be a type H
+/* Whether ptr points into the arena itself, huge blocks are not */
+static int inArenaInternal( struct Arena * arena, void * ptr )
+{
+  return arena->base != NULL && (char *)ptr >= (char *)arena->base &&
+         (char *)ptr < (char *)arena->base + arena->size;
+}
+
+/**
+ *
+ * \fn findBlockInternal(struct Arena * arena, void * ptr)
+ *
+ * \brief Find the ledger index of the allocated block starting at ptr
+ *
+ * \return The index on success
+ * \return -1 if ptr is not an allocated block
+ */
+static int findBlockInternal( struct Arena * arena, void * ptr )
+{
+  size_t offset;
   int i;
-  for( i = 0; i < MAX_LINKED_LIST_SIZE; i ++)
+
+  if( !inArenaInternal( arena, ptr ) )
   {
-    if( ptr == LinkedList[i].arena )
+    return -1;
+  }
+  offset = (char *)ptr - (char *)arena->base;
+
+  // temporaries released in the reverse order they were taken are always
+  // the block at the top, only the others need the scan
+  i = topBlockInternal( arena );
+  if( i != -1 && offset == arena->ledger[i].offset && arena->ledger[i].type == P )
+  {
+    return i;
+  }
+
+  // the order does not matter here, a plain pass over the array is cheaper
+  // than following the links
+  for( i = 0; i <= arena->high_water; i++ )
+  {
+    if( offset == arena->ledger[i].offset && arena->ledger[i].in_use && arena->ledger[i].type == P )
     {
-      //printf("\nLinkedList[%d].type = H", i);
-      LinkedList[i].type = H;
-      //return;
+      return i;
     }
   }
-  // check if adjacent nodes are free
-  // if they are, then combine them
-  for( i = 0; i < MAX_LINKED_LIST_SIZE-1; i ++)
+  return -1;
+}
+
+/**
+ *
+ * \fn ownsHugeInternal(struct Arena * arena, void * ptr)
+ *
+ * \brief Whether ptr is one of the arena's huge blocks
+ *
+ * Only a node arena can be in use by another thread, and only its lock
+ * guards the table, huge blocks never belong to a shared arena.
+ */
+static int ownsHugeInternal( struct Arena * arena, void * ptr )
+{
+  int slot;
+
+  if( arena->thread_safe )
+  {
+    pthread_mutex_lock( &arena->lock );
+  }
+  slot = findHugeInternal( arena, ptr );
+  if( arena->thread_safe )
+  {
+    pthread_mutex_unlock( &arena->lock );
+  }
+  return slot != -1;
+}
+
+/**
+ *
+ * \fn ownerArenaInternal(void * ptr)
+ *
+ * \brief The arena the block at ptr was allocated from
+ *
+ * Any thread may free a block, not only the one that allocated it, so the
+ * block is looked for by address: in the calling thread's arena, then in the
+ * process wide one and the node arenas.  Huge blocks lie outside every arena
+ * and are looked up in each arena's table once no arena contains ptr.
+ *
+ * \return The arena on success
+ * \return NULL if no arena owns ptr
+ */
+static struct Arena * ownerArenaInternal( void * ptr )
+{
+  int limit = __atomic_load_n( &node_arena_limit, __ATOMIC_ACQUIRE );
+  struct Arena * arena;
+  int i;
+
+  if( inArenaInternal( gCurrent, ptr ) )
+  {
+    return gCurrent;
+  }
+  if( gCurrent != &DefaultArena && inArenaInternal( &DefaultArena, ptr ) )
+  {
+    return &DefaultArena;
+  }
+  for( i = 0; i < limit; i++ )
+  {
+    arena = __atomic_load_n( &NodeArenas[i], __ATOMIC_ACQUIRE );
+    if( arena != NULL && arena != gCurrent && inArenaInternal( arena, ptr ) )
+    {
+      return arena;
+    }
+  }
+
+  if( ownsHugeInternal( gCurrent, ptr ) )
+  {
+    return gCurrent;
+  }
+  if( gCurrent != &DefaultArena && ownsHugeInternal( &DefaultArena, ptr ) )
+  {
+    return &DefaultArena;
+  }
+  for( i = 0; i < limit; i++ )
+  {
+    arena = __atomic_load_n( &NodeArenas[i], __ATOMIC_ACQUIRE );
+    if( arena != NULL && arena != gCurrent && ownsHugeInternal( arena, ptr ) )
+    {
+      return arena;
+    }
+  }
+  return NULL;
+}
+
+/* Deferred coalescing.  When enabled, mavalloc_free parks blocks in the quick
+ * list instead of returning them to the ledger.  They stay type P so no
+ * search hands them out, and an allocation of exactly the same size takes one
+ * back without touching the ledger.  Parked blocks are turned into holes and
+ * merged in a single pass over the ledger when the list overflows or when an
+ * allocation would otherwise fail.
+ */
+
+static void * quickAllocInternal( struct Arena * arena, size_t size )
+{
+  int i;
+
+  // most recently freed first, it is the most likely to still be in cache
+  for( i = arena->quick_count - 1; i >= 0; i-- )
+  {
+    if( (size_t)arena->quick_list[i].size == size )
+    {
+      void * block = arena->quick_list[i].arena;
+      arena->quick_list[i] = arena->quick_list[--arena->quick_count];
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static int compareQuickEntries( const void * a, const void * b )
+{
+  const struct QuickEntry * x = a;
+  const struct QuickEntry * y = b;
+  return ( x->arena > y->arena ) - ( x->arena < y->arena );
+}
+
+/**
+ *
+ * \fn flushQuickListInternal(struct Arena * arena)
+ *
+ * \brief Return every parked block to the ledger and coalesce
+ *
+ * The parked blocks are sorted by address so they can all be found in one
+ * walk of the address ordered ledger, then a second walk merges every run of
+ * adjacent holes into its first node and puts the holes back on the hole
+ * list.
+ */
+static void flushQuickListInternal( struct Arena * arena )
+{
+  int i;
+  int j = 0;
+
+  if( arena->quick_count == 0 )
+  {
+    return;
+  }
+
+  PROBE2( quick_flush, arena->quick_count, arena->node_count );
+  qsort( arena->quick_list, arena->quick_count, sizeof( struct QuickEntry ), compareQuickEntries );
+
+  for( i = arena->head; i != -1 && j < arena->quick_count; i = arena->ledger[i].next )
+  {
+    if( (char *)arena->base + arena->ledger[i].offset == arena->quick_list[j].arena )
+    {
+      arena->ledger[i].type = H;
+      j++;
+    }
+  }
+  arena->quick_count = 0;
+
+  for( i = arena->head; i != -1; i = arena->ledger[i].next )
   {
-    if( ptr == LinkedList[i].arena )
+    while( arena->ledger[i].type == H && arena->ledger[i].next != -1 &&
+           arena->ledger[ arena->ledger[i].next ].type == H )
     {
-      if( LinkedList[i].type == H && LinkedList[i+1].type == H && LinkedList[i+1].in_use == 1)
+      j = arena->ledger[i].next;
+      arena->ledger[i].size += arena->ledger[j].size;
+      if( arena->next_fit_hole == j )
       {
-        // combine the sizes into LinkedList[i]
-        // remove LinkedList[i+1]
-        //printf("\nremoveNode(LinkedList[%d+1].size", i);
-        
-        LinkedList[i].size = LinkedList[i].size + LinkedList[i+1].size;
-        removeNode(LinkedList[i+1].size);
+        arena->next_fit_hole = i;
       }
+      removeNodeInternal( arena, j );
     }
   }
-  
-  
-  return;
+  rebuildHolesInternal( arena );
 }
 
-int mavalloc_size( )
+void mavalloc_set_deferred_coalescing( int enabled )
 {
-  // allocator size
+  struct Arena * arena = gCurrent;
 
-    // return the number of nodes in the allocators linked list
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  if( !enabled )
+  {
+    flushQuickListInternal( arena );
+  }
+  arena->deferred_coalescing = enabled;
+  unlockArenaInternal( arena );
+}
 
-    //return the size of the allactor linked list
-  
-  int number_of_nodes = 0;
-  //count number of nodes?
-  int i = 0;
-  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+/* Adaptive placement.  Allocations are counted in windows.  At the end of
+ * each window the average search length and the fragmentation of the free
+ * space decide which policy serves the next window: FIRST_FIT while searches
+ * are short, NEXT_FIT once they get long, and BEST_FIT whenever fragmentation
+ * passes its limit or an allocation failed.  BEST_FIT is only left again once
+ * fragmentation falls to half the limit so the policy does not flap between
+ * windows.
+ */
+
+/**
+ *
+ * \fn fragmentationInternal(struct Arena * arena, size_t request)
+ *
+ * \brief Percentage of the free space sitting in holes too small for request
+ *
+ * Many small holes only matter if the workload asks for blocks that do not
+ * fit in them, so fragmentation is measured against the largest request
+ * seen recently.
+ */
+static int fragmentationInternal( struct Arena * arena, size_t request )
+{
+  long free_bytes = 0;
+  long unusable = 0;
+  int i;
+
+  for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
   {
-    if( LinkedList[i].in_use )
+    free_bytes += arena->ledger[i].size;
+    if( (size_t)arena->ledger[i].size < request )
     {
-      number_of_nodes ++;
+      unusable += arena->ledger[i].size;
     }
   }
-  return number_of_nodes;
+  if( free_bytes == 0 )
+  {
+    return 0;
+  }
+  return (int)( 100 * unusable / free_bytes );
+}
+
+static void adaptInternal( struct Arena * arena, size_t size, void * ptr )
+{
+  int fragmentation;
+  long average_search;
+  enum ALGORITHM next = arena->policy;
+
+  arena->window_allocations++;
+  arena->window_search_length += arena->search_length;
+  if( size > arena->window_largest_request )
+  {
+    arena->window_largest_request = size;
+  }
+  if( ptr == NULL )
+  {
+    arena->window_failures++;
+  }
+
+  if( arena->window_allocations < arena->adaptive_window )
+  {
+    return;
+  }
+
+  fragmentation = fragmentationInternal( arena, arena->window_largest_request );
+  average_search = arena->window_search_length / arena->window_allocations;
+
+  if( fragmentation > arena->adaptive_max_fragmentation || arena->window_failures > 0 )
+  {
+    next = BEST_FIT;
+  }
+  else if( arena->policy != BEST_FIT || fragmentation <= arena->adaptive_max_fragmentation / 2 )
+  {
+    // NEXT_FIT's own searches are short whatever the ledger looks like, so
+    // only a ledger short enough for FIRST_FIT to scan cheaply brings
+    // FIRST_FIT back
+    if( arena->node_count <= arena->adaptive_max_search )
+    {
+      next = FIRST_FIT;
+    }
+    else if( arena->policy == NEXT_FIT || average_search > arena->adaptive_max_search )
+    {
+      next = NEXT_FIT;
+    }
+    else
+    {
+      next = FIRST_FIT;
+    }
+  }
+
+  if( next != arena->policy )
+  {
+    arena->policy = next;
+    arena->next_fit_hole = arena->hole_head;
+  }
+
+  arena->window_allocations = 0;
+  arena->window_search_length = 0;
+  arena->window_failures = 0;
+  arena->window_largest_request = 0;
+}
+
+static ALWAYS_INLINE void * placeInternal( struct Arena * arena, size_t new_size,
+                                           enum ALGORITHM algorithm )
+{
+  void * ptr;
+
+  if( algorithm != ADAPTIVE )
+  {
+    return allocInternal( arena, new_size, algorithm );
+  }
+
+  ptr = allocInternal( arena, new_size, arena->policy );
+  adaptInternal( arena, new_size, ptr );
+  return ptr;
+}
+
+/**
+ *
+ * \fn alignedPlaceInternal(struct Arena * arena, size_t new_size, size_t alignment)
+ *
+ * \brief Place a request at an address that is a multiple of alignment
+ *
+ * Takes the lowest hole with room for the block once its start is rounded
+ * up.  The bytes skipped to get there are given to the node before the hole,
+ * so a run of aligned blocks takes one node each as unaligned ones do.  Only
+ * a hole at the start of the arena leaves its padding as a hole of its own.
+ *
+ * \return Pointer to the allocated block, NULL if nothing fits
+ */
+static void * alignedPlaceInternal( struct Arena * arena, size_t new_size, size_t alignment )
+{
+  int i;
+
+  for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
+  {
+    uintptr_t start;
+    size_t padding;
+    int previous;
+    int rest;
+
+    start = (uintptr_t)arena->base + arena->ledger[i].offset;
+    padding = ( ( start + alignment - 1 ) & ~( (uintptr_t)alignment - 1 ) ) - start;
+    if( padding + new_size > (size_t)arena->ledger[i].size )
+    {
+      continue;
+    }
+    if( padding == 0 )
+    {
+      return allocateHoleInternal( arena, i, new_size );
+    }
+
+    previous = arena->ledger[i].previous;
+    if( previous != -1 )
+    {
+      // the rest of the hole needs a node, check before the padding is
+      // handed over
+      if( padding + new_size < (size_t)arena->ledger[i].size &&
+          arena->node_count >= MAX_LINKED_LIST_SIZE )
+      {
+        return NULL;
+      }
+      arena->ledger[previous].size += padding;
+      arena->ledger[i].offset += padding;
+      arena->ledger[i].size -= padding;
+      return allocateHoleInternal( arena, i, new_size );
+    }
+
+    // the padding and the block each take a node, there must be room for both
+    if( arena->node_count + 2 > MAX_LINKED_LIST_SIZE ||
+        ( rest = insertNodeInternal( arena, i, arena->ledger[i].size - padding ) ) == -1 )
+    {
+      return NULL;
+    }
+    arena->ledger[i].size = padding;
+    arena->ledger[rest].type = H;
+    arena->ledger[rest].offset = arena->ledger[i].offset + padding;
+    linkHoleInternal( arena, rest, i );
+    return allocateHoleInternal( arena, rest, new_size );
+  }
+  return NULL;
+}
+
+/* Shared arenas.  The shared memory object holds a header with the ledger
+ * and a process-shared mutex, followed by the arena.  Every process maps it
+ * at its own address, the ledger only records offsets.
+ *
+ * The ends of the ledger and hole lists, the free stack, the node count and
+ * high water mark, the NEXT_FIT cursor and the root are kept in each
+ * process's struct Arena.  They are loaded from the header when the lock is taken and
+ * stored back before it is released, so the code in between runs exactly as
+ * it does for a private arena.
+ *
+ * The mutex is robust.  If a process dies holding it the next one to lock it
+ * checks the ledger; a ledger left half relinked marks the arena broken and
+ * every later allocation fails rather than hand out overlapping blocks.
+ */
+#define SHARED_MAGIC    "MAVSHARE"
+#define SHARED_VERSION  2
+
+struct SharedHeader
+{
+  char magic[8];
+  unsigned int version;
+  int ready;
+  int broken;
+  pthread_mutex_t lock;
+  long size;
+  size_t arena_offset;
+  int head;
+  int tail;
+  int free_slot;
+  int node_count;
+  int high_water;
+  int hole_head;
+  int hole_tail;
+  int next_fit_hole;
+  long root;
+  struct Node nodes[MAX_LINKED_LIST_SIZE];
+};
+
+static int validateLedgerInternal( struct Node * nodes, long size );
+
+/**
+ *
+ * \fn lockArenaInternal(struct Arena * arena)
+ *
+ * \brief Take the lock of a node or shared arena
+ *
+ * A shared arena also has its ledger state loaded.  Does nothing for an
+ * arena used by a single thread.
+ *
+ * \return 0 on success
+ * \return -1 if the lock could not be taken or the arena is broken
+ */
+static int lockArenaInternal( struct Arena * arena )
+{
+  struct SharedHeader * shared = arena->shared;
+  int rc;
+
+  if( arena->thread_safe )
+  {
+    pthread_mutex_lock( &arena->lock );
+  }
+  if( shared == NULL )
+  {
+    return 0;
+  }
+
+  rc = pthread_mutex_lock( &shared->lock );
+  if( rc == EOWNERDEAD )
+  {
+    // the owner died part way through an operation, keep going only if it
+    // left the ledger whole
+    if( validateLedgerInternal( shared->nodes, shared->size ) == -1 )
+    {
+      shared->broken = 1;
+    }
+    else
+    {
+      // the nodes are whole, the list state around them may not be
+      loadLedgerInternal( arena );
+      shared->head = arena->head;
+      shared->tail = arena->tail;
+      shared->free_slot = arena->free_slot;
+      shared->node_count = arena->node_count;
+      shared->high_water = arena->high_water;
+      shared->hole_head = arena->hole_head;
+      shared->hole_tail = arena->hole_tail;
+      shared->next_fit_hole = arena->hole_head;
+    }
+    pthread_mutex_consistent( &shared->lock );
+  }
+  else if( rc != 0 )
+  {
+    return -1;
+  }
+
+  if( shared->broken )
+  {
+    pthread_mutex_unlock( &shared->lock );
+    return -1;
+  }
+
+  arena->head = shared->head;
+  arena->tail = shared->tail;
+  arena->free_slot = shared->free_slot;
+  arena->node_count = shared->node_count;
+  arena->high_water = shared->high_water;
+  arena->hole_head = shared->hole_head;
+  arena->hole_tail = shared->hole_tail;
+  arena->next_fit_hole = shared->next_fit_hole;
+  arena->root = shared->root;
+  return 0;
+}
+
+/**
+ *
+ * \fn unlockArenaInternal(struct Arena * arena)
+ *
+ * \brief Release the lock of a node or shared arena
+ *
+ * A shared arena has its ledger state stored back first.
+ */
+static void unlockArenaInternal( struct Arena * arena )
+{
+  struct SharedHeader * shared = arena->shared;
+
+  if( shared != NULL )
+  {
+    shared->head = arena->head;
+    shared->tail = arena->tail;
+    shared->free_slot = arena->free_slot;
+    shared->node_count = arena->node_count;
+    shared->high_water = arena->high_water;
+    shared->hole_head = arena->hole_head;
+    shared->hole_tail = arena->hole_tail;
+    shared->next_fit_hole = arena->next_fit_hole;
+    shared->root = arena->root;
+    pthread_mutex_unlock( &shared->lock );
+  }
+  if( arena->thread_safe )
+  {
+    pthread_mutex_unlock( &arena->lock );
+  }
+}
+
+/* Latency histograms, compiled in with -DMAVALLOC_STATS.  Every allocation
+ * and free is timed with the processor's cycle counter and counted in the
+ * histogram for its operation and placement policy, in the bucket of the
+ * highest set bit of the cycle count.  The counters are updated with relaxed
+ * atomic adds, threads never wait for each other.
+ */
+#ifdef MAVALLOC_STATS
+static unsigned long LatencyHistogram[MAVALLOC_OP_FREE + 1][SEGREGATED + 1][MAVALLOC_LATENCY_BUCKETS];
+
+static inline uint64_t cyclesInternal( )
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __builtin_ia32_rdtsc( );
+#elif defined( __aarch64__ )
+  uint64_t cycles;
+  __asm__ __volatile__( "mrs %0, cntvct_el0" : "=r"( cycles ) );
+  return cycles;
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static inline void recordLatencyInternal( enum MAVALLOC_OPERATION operation,
+                                          enum ALGORITHM algorithm, uint64_t cycles )
+{
+  int bucket = 63 - __builtin_clzll( cycles | 1 );
+  __atomic_fetch_add( &LatencyHistogram[operation][algorithm][bucket], 1, __ATOMIC_RELAXED );
+}
+
+#define LATENCY_START( )                        uint64_t latency_start = cyclesInternal( )
+#define LATENCY_RECORD( operation, algorithm )  \
+  recordLatencyInternal( operation, algorithm, cyclesInternal( ) - latency_start )
+#else
+#define LATENCY_START( )
+#define LATENCY_RECORD( operation, algorithm )
+#endif
+
+int mavalloc_latency_histogram( enum MAVALLOC_OPERATION operation, enum ALGORITHM algorithm,
+                                unsigned long counts[MAVALLOC_LATENCY_BUCKETS] )
+{
+#ifdef MAVALLOC_STATS
+  int bucket;
+
+  if( operation < MAVALLOC_OP_ALLOC || operation > MAVALLOC_OP_FREE ||
+      algorithm < FIRST_FIT || algorithm > SEGREGATED )
+  {
+    return -1;
+  }
+  for( bucket = 0; bucket < MAVALLOC_LATENCY_BUCKETS; bucket++ )
+  {
+    counts[bucket] = __atomic_load_n( &LatencyHistogram[operation][algorithm][bucket],
+                                      __ATOMIC_RELAXED );
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void mavalloc_latency_reset( )
+{
+#ifdef MAVALLOC_STATS
+  unsigned long * counter = &LatencyHistogram[0][0][0];
+  size_t i;
+
+  for( i = 0; i < sizeof( LatencyHistogram ) / sizeof( LatencyHistogram[0][0][0] ); i++ )
+  {
+    __atomic_store_n( &counter[i], 0, __ATOMIC_RELAXED );
+  }
+#endif
+}
+
+/* Heap profiler.  Allocations are sampled on average once every
+ * profile_period bytes.  Each thread counts down the bytes it allocates and
+ * the allocation that takes the count below zero has its stack recorded.
+ * The next count is drawn from an exponential distribution, so every byte is
+ * equally likely to be sampled and pprof can scale the samples back up to
+ * the real totals.
+ *
+ * While the profiler is off the count is only ever reset to
+ * PROFILE_IDLE_PERIOD, so an allocation costs one decrement and a thread
+ * notices the profiler has been turned on within that many bytes.
+ *
+ * Sampled blocks are remembered in ProfileSamples so that freeing one takes
+ * its bytes off the live count of its call site.  Both tables are shared by
+ * every thread and arena and guarded by profile_lock.  A sampled block is
+ * also flagged in its ledger node or huge block slot, so only sampled
+ * allocations and frees of flagged blocks take the lock.  Samples that find
+ * the site table or the sample table full are counted in profile_dropped.
+ */
+#define PROFILE_DEFAULT_PERIOD  ( 512 * 1024 )
+#define PROFILE_IDLE_PERIOD     ( 64 * 1024 * 1024 )
+#define PROFILE_MAX_DEPTH       32
+#define PROFILE_SITES           1024
+#define PROFILE_SAMPLES         8192
+
+struct ProfileSite
+{
+  /** Frames in stack, 0 for an empty slot */
+  int depth;
+  void * stack[PROFILE_MAX_DEPTH];
+  long alloc_objects;
+  long alloc_bytes;
+  long live_objects;
+  long live_bytes;
+};
+
+struct ProfileSample
+{
+  /** The sampled block, NULL for an empty slot */
+  void * ptr;
+  size_t size;
+  int site;
+};
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static int profile_enabled = 0;
+static size_t profile_period = PROFILE_DEFAULT_PERIOD;
+static int profile_site_count = 0;
+static int profile_sample_count = 0;
+static long profile_dropped = 0;
+static struct ProfileSite ProfileSites[PROFILE_SITES];
+static struct ProfileSample ProfileSamples[PROFILE_SAMPLES];
+
+static __thread long profile_countdown __attribute__(( tls_model( "initial-exec" ) )) = 0;
+static __thread unsigned int profile_random __attribute__(( tls_model( "initial-exec" ) )) = 0;
+
+static int writeAllInternal( int fd, const void * data, size_t length );
+
+/**
+ *
+ * \fn nextSampleIntervalInternal()
+ *
+ * \brief Bytes until the calling thread takes its next sample
+ *
+ * -ln(U) * profile_period for a uniform U, with the logarithm approximated
+ * so the library needs no libm.
+ */
+static long nextSampleIntervalInternal( )
+{
+  unsigned int q;
+  double mantissa;
+  int exponent;
+
+  if( profile_random == 0 )
+  {
+    profile_random = (unsigned int)(uintptr_t)&q | 1;
+  }
+  profile_random ^= profile_random << 13;
+  profile_random ^= profile_random >> 17;
+  profile_random ^= profile_random << 5;
+
+  // q is uniform in 1 .. 2^26, log2(q) from its exponent and a quadratic
+  // fit of log2 over the mantissa
+  q = ( profile_random >> 6 ) + 1;
+  exponent = 31 - __builtin_clz( q );
+  mantissa = (double)q / ( 1u << exponent ) - 1.0;
+
+  return (long)( ( 26.0 - exponent - mantissa * ( 4.0 / 3.0 - mantissa / 3.0 ) ) *
+                 0.6931471805599453 * profile_period ) + 1;
+}
+
+static int sampleHomeInternal( void * ptr )
+{
+  return ( ( (uintptr_t)ptr >> 4 ) * 0x9E3779B97F4A7C15ull >> 32 ) & ( PROFILE_SAMPLES - 1 );
+}
+
+/**
+ *
+ * \fn findSiteInternal(void ** stack, int depth)
+ *
+ * \brief Find or add the call site with this stack
+ *
+ * \return The site on success
+ * \return -1 if the site table is full
+ */
+static int findSiteInternal( void ** stack, int depth )
+{
+  uintptr_t hash = depth;
+  int site;
+  int i;
+
+  for( i = 0; i < depth; i++ )
+  {
+    hash = ( hash ^ (uintptr_t)stack[i] ) * 0x100000001B3ull;
+  }
+
+  for( site = ( hash >> 16 ) & ( PROFILE_SITES - 1 ); ProfileSites[site].depth != 0;
+       site = ( site + 1 ) & ( PROFILE_SITES - 1 ) )
+  {
+    if( ProfileSites[site].depth == depth &&
+        memcmp( ProfileSites[site].stack, stack, depth * sizeof( void * ) ) == 0 )
+    {
+      return site;
+    }
+  }
+
+  if( profile_site_count >= PROFILE_SITES * 3 / 4 )
+  {
+    return -1;
+  }
+  ProfileSites[site].depth = depth;
+  memcpy( ProfileSites[site].stack, stack, depth * sizeof( void * ) );
+  profile_site_count++;
+  return site;
+}
+
+/**
+ *
+ * \fn markSampledInternal(void * ptr)
+ *
+ * \brief Flag a block just sampled in its ledger node or huge block slot
+ */
+static void markSampledInternal( void * ptr )
+{
+  struct Arena * arena = ownerArenaInternal( ptr );
+  int i;
+
+  if( arena == NULL || lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  if( ( i = findHugeInternal( arena, ptr ) ) != -1 )
+  {
+    arena->huge_table[i].sampled = 1;
+  }
+  else if( ( i = findBlockInternal( arena, ptr ) ) != -1 )
+  {
+    arena->ledger[i].sampled = 1;
+  }
+  unlockArenaInternal( arena );
+}
+
+/**
+ *
+ * \fn sampleInternal(void * ptr, size_t size)
+ *
+ * \brief Record the stack of an allocation whose countdown ran out
+ *
+ * Never inlined, the first two frames of the stack it takes are its own and
+ * the allocator entry point's.
+ */
+static void __attribute__(( noinline )) sampleInternal( void * ptr, size_t size )
+{
+  void * stack[ PROFILE_MAX_DEPTH + 2 ];
+  int depth;
+  int site;
+  int slot;
+  int recorded = 0;
+
+  if( !__atomic_load_n( &profile_enabled, __ATOMIC_RELAXED ) )
+  {
+    profile_countdown = PROFILE_IDLE_PERIOD;
+    return;
+  }
+  profile_countdown = nextSampleIntervalInternal( );
+
+  depth = backtrace( stack, PROFILE_MAX_DEPTH + 2 ) - 2;
+  if( depth <= 0 )
+  {
+    return;
+  }
+
+  pthread_mutex_lock( &profile_lock );
+  site = findSiteInternal( stack + 2, depth );
+  if( site != -1 && profile_sample_count < PROFILE_SAMPLES * 3 / 4 )
+  {
+    for( slot = sampleHomeInternal( ptr ); ProfileSamples[slot].ptr != NULL;
+         slot = ( slot + 1 ) & ( PROFILE_SAMPLES - 1 ) )
+    {
+    }
+    ProfileSamples[slot].ptr = ptr;
+    ProfileSamples[slot].size = size;
+    ProfileSamples[slot].site = site;
+    profile_sample_count++;
+    recorded = 1;
+
+    ProfileSites[site].alloc_objects++;
+    ProfileSites[site].alloc_bytes += size;
+    ProfileSites[site].live_objects++;
+    ProfileSites[site].live_bytes += size;
+  }
+  else
+  {
+    profile_dropped++;
+  }
+  pthread_mutex_unlock( &profile_lock );
+
+  if( recorded )
+  {
+    markSampledInternal( ptr );
+  }
+}
+
+/**
+ *
+ * \fn profileFreeInternal(void * ptr)
+ *
+ * \brief Take a block being freed off the live count if it was sampled
+ */
+static void profileFreeInternal( void * ptr )
+{
+  int slot;
+
+  pthread_mutex_lock( &profile_lock );
+  for( slot = sampleHomeInternal( ptr ); ProfileSamples[slot].ptr != NULL;
+       slot = ( slot + 1 ) & ( PROFILE_SAMPLES - 1 ) )
+  {
+    if( ProfileSamples[slot].ptr == ptr )
+    {
+      struct ProfileSite * site = &ProfileSites[ ProfileSamples[slot].site ];
+      int next = ( slot + 1 ) & ( PROFILE_SAMPLES - 1 );
+
+      site->live_objects--;
+      site->live_bytes -= ProfileSamples[slot].size;
+
+      // shift the rest of the probe run back, as removeHugeInternal does
+      while( ProfileSamples[next].ptr != NULL )
+      {
+        int home = sampleHomeInternal( ProfileSamples[next].ptr );
+
+        if( ( ( next - home ) & ( PROFILE_SAMPLES - 1 ) ) >=
+            ( ( next - slot ) & ( PROFILE_SAMPLES - 1 ) ) )
+        {
+          ProfileSamples[slot] = ProfileSamples[next];
+          slot = next;
+        }
+        next = ( next + 1 ) & ( PROFILE_SAMPLES - 1 );
+      }
+      ProfileSamples[slot].ptr = NULL;
+      profile_sample_count--;
+      break;
+    }
+  }
+  pthread_mutex_unlock( &profile_lock );
+}
+
+static void clearProfileInternal( )
+{
+  memset( ProfileSites, 0, sizeof( ProfileSites ) );
+  memset( ProfileSamples, 0, sizeof( ProfileSamples ) );
+  profile_site_count = 0;
+  profile_sample_count = 0;
+  profile_dropped = 0;
+}
+
+int mavalloc_profile_start( size_t sample_period )
+{
+  void * unwinder[1];
+
+  // the first backtrace loads the unwinder, which allocates, do it now
+  // rather than from inside an allocation
+  backtrace( unwinder, 1 );
+
+  pthread_mutex_lock( &profile_lock );
+  clearProfileInternal( );
+  profile_period = sample_period != 0 ? sample_period : PROFILE_DEFAULT_PERIOD;
+  __atomic_store_n( &profile_enabled, 1, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &profile_lock );
+
+  profile_countdown = nextSampleIntervalInternal( );
+  return 0;
+}
+
+void mavalloc_profile_stop( )
+{
+  pthread_mutex_lock( &profile_lock );
+  __atomic_store_n( &profile_enabled, 0, __ATOMIC_RELAXED );
+  clearProfileInternal( );
+  pthread_mutex_unlock( &profile_lock );
+}
+
+int mavalloc_profile_dump( const char * path )
+{
+  long live_objects = 0, live_bytes = 0, alloc_objects = 0, alloc_bytes = 0;
+  char line[ 64 + PROFILE_MAX_DEPTH * 20 ];
+  int length;
+  int result = 0;
+  int maps;
+  int fd;
+  int i, j;
+
+  fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if( fd == -1 )
+  {
+    return -1;
+  }
+
+  // pprof's legacy heap format: the totals, one line per call site with
+  // its sampled live and allocated counts, then the memory map to
+  // symbolize the addresses with
+  pthread_mutex_lock( &profile_lock );
+  for( i = 0; i < PROFILE_SITES; i++ )
+  {
+    live_objects += ProfileSites[i].live_objects;
+    live_bytes += ProfileSites[i].live_bytes;
+    alloc_objects += ProfileSites[i].alloc_objects;
+    alloc_bytes += ProfileSites[i].alloc_bytes;
+  }
+
+  length = snprintf( line, sizeof( line ), "heap profile: %6ld: %8ld [%6ld: %8ld] @ heap_v2/%zu\n",
+                     live_objects, live_bytes, alloc_objects, alloc_bytes, profile_period );
+  result |= writeAllInternal( fd, line, length );
+
+  if( profile_dropped > 0 )
+  {
+    length = snprintf( line, sizeof( line ), "# %ld samples dropped, site or sample table full\n",
+                       profile_dropped );
+    result |= writeAllInternal( fd, line, length );
+  }
+
+  for( i = 0; i < PROFILE_SITES; i++ )
+  {
+    if( ProfileSites[i].depth == 0 )
+    {
+      continue;
+    }
+    length = snprintf( line, sizeof( line ), "%6ld: %8ld [%6ld: %8ld] @",
+                       ProfileSites[i].live_objects, ProfileSites[i].live_bytes,
+                       ProfileSites[i].alloc_objects, ProfileSites[i].alloc_bytes );
+    for( j = 0; j < ProfileSites[i].depth; j++ )
+    {
+      length += snprintf( line + length, sizeof( line ) - length, " %p", ProfileSites[i].stack[j] );
+    }
+    line[ length++ ] = '\n';
+    result |= writeAllInternal( fd, line, length );
+  }
+  pthread_mutex_unlock( &profile_lock );
+
+  length = snprintf( line, sizeof( line ), "\nMAPPED_LIBRARIES:\n" );
+  result |= writeAllInternal( fd, line, length );
+
+  maps = open( "/proc/self/maps", O_RDONLY );
+  if( maps != -1 )
+  {
+    ssize_t got;
+    while( ( got = read( maps, line, sizeof( line ) ) ) > 0 )
+    {
+      result |= writeAllInternal( fd, line, got );
+    }
+    close( maps );
+  }
+
+  if( close( fd ) == -1 )
+  {
+    result = -1;
+  }
+  return result == 0 ? 0 : -1;
+}
+
+/**
+ *
+ * \fn allocPathInternal(struct Arena * arena, size_t new_size, enum ALGORITHM algorithm)
+ *
+ * \brief Allocate an already aligned request, placing it with algorithm
+ *
+ * Everything mavalloc_alloc does: huge blocks, the shared lock, deferred
+ * coalescing and the policy search.
+ */
+static ALWAYS_INLINE void * allocPathInternal( struct Arena * arena, size_t new_size,
+                                               enum ALGORITHM algorithm )
+{
+  void * ptr = NULL;
+
+  if( arena->base == NULL || new_size == 0 || lockArenaInternal( arena ) == -1 )
+  {
+    return NULL;
+  }
+
+  if( arena->huge_threshold != 0 && new_size >= arena->huge_threshold &&
+      arena->persistent == NULL && arena->shared == NULL )
+  {
+    ptr = hugeAllocInternal( arena, new_size );
+  }
+
+  // blocks parked in one process would be invisible to the others, a shared
+  // arena always coalesces immediately
+  if( ptr == NULL && arena->deferred_coalescing && arena->shared == NULL )
+  {
+    ptr = quickAllocInternal( arena, new_size );
+  }
+
+  if( ptr == NULL )
+  {
+    ptr = placeInternal( arena, new_size, algorithm );
+
+    // the blocks parked for deferred coalescing may merge into a hole that
+    // fits
+    if( ptr == NULL && arena->quick_count > 0 )
+    {
+      flushQuickListInternal( arena );
+      ptr = placeInternal( arena, new_size, algorithm );
+    }
+  }
+  unlockArenaInternal( arena );
+  return ptr;
+}
+
+#define POLICY_ALLOC( name, algorithm )                                   \
+  void * name( size_t size )                                              \
+  {                                                                       \
+    LATENCY_START( );                                                     \
+    PROBE1( alloc_entry, size );                                          \
+    void * ptr = allocPathInternal( gCurrent, ALIGN4( size ), algorithm ); \
+    if( ptr != NULL && ( profile_countdown -= size ) < 0 )                \
+    {                                                                     \
+      sampleInternal( ptr, ALIGN4( size ) );                              \
+    }                                                                     \
+    LATENCY_RECORD( MAVALLOC_OP_ALLOC, algorithm );                       \
+    PROBE3( alloc_return, ptr, size, algorithm );                         \
+    return ptr;                                                           \
+  }
+
+POLICY_ALLOC( mavalloc_alloc_first_fit, FIRST_FIT )
+POLICY_ALLOC( mavalloc_alloc_next_fit, NEXT_FIT )
+POLICY_ALLOC( mavalloc_alloc_best_fit, BEST_FIT )
+POLICY_ALLOC( mavalloc_alloc_worst_fit, WORST_FIT )
+POLICY_ALLOC( mavalloc_alloc_adaptive, ADAPTIVE )
+POLICY_ALLOC( mavalloc_alloc_segregated, SEGREGATED )
+
+void * mavalloc_alloc( size_t size )
+{
+  //Allocate memory from the arena
+
+    // Size specifies the number of bytes to allocate
+        // must use the ALIGN4 macro
+  // allocate size
+  switch( gCurrent->algorithm )
+  {
+    case FIRST_FIT:
+      return mavalloc_alloc_first_fit( size );
+    case NEXT_FIT:
+      return mavalloc_alloc_next_fit( size );
+    case BEST_FIT:
+      return mavalloc_alloc_best_fit( size );
+    case WORST_FIT:
+      return mavalloc_alloc_worst_fit( size );
+    case SEGREGATED:
+      return mavalloc_alloc_segregated( size );
+    default:
+      return mavalloc_alloc_adaptive( size );
+  }
+}
+
+/**
+ *
+ * \fn alignedPathInternal(struct Arena * arena, size_t new_size, size_t alignment)
+ *
+ * \brief Allocate an already aligned request at a multiple of alignment
+ *
+ * Everything mavalloc_alloc_aligned does apart from the instrumentation.
+ */
+static void * alignedPathInternal( struct Arena * arena, size_t new_size, size_t alignment )
+{
+  void * ptr = NULL;
+
+  if( arena->base == NULL || new_size == 0 || lockArenaInternal( arena ) == -1 )
+  {
+    return NULL;
+  }
+
+  if( alignment <= HUGE_ALIGNMENT && arena->huge_threshold != 0 &&
+      new_size >= arena->huge_threshold && arena->persistent == NULL && arena->shared == NULL )
+  {
+    ptr = hugeAllocInternal( arena, new_size );
+  }
+
+  if( ptr == NULL )
+  {
+    ptr = alignedPlaceInternal( arena, new_size, alignment );
+
+    // parked blocks are not checked for alignment, but merged back they may
+    // make room
+    if( ptr == NULL && arena->quick_count > 0 )
+    {
+      flushQuickListInternal( arena );
+      ptr = alignedPlaceInternal( arena, new_size, alignment );
+    }
+  }
+  unlockArenaInternal( arena );
+  return ptr;
+}
+
+void * mavalloc_alloc_aligned( size_t size, size_t alignment )
+{
+  void * ptr;
+
+  if( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+  {
+    return NULL;
+  }
+  if( alignment <= 4 )
+  {
+    return mavalloc_alloc( size );
+  }
+
+  // the lowest hole that fits is taken whatever the policy, it is filed as
+  // FIRST_FIT
+  LATENCY_START( );
+  PROBE1( alloc_entry, size );
+  ptr = alignedPathInternal( gCurrent, ALIGN4( size ), alignment );
+  if( ptr != NULL && ( profile_countdown -= size ) < 0 )
+  {
+    sampleInternal( ptr, ALIGN4( size ) );
+  }
+  LATENCY_RECORD( MAVALLOC_OP_ALLOC, FIRST_FIT );
+  PROBE3( alloc_return, ptr, size, FIRST_FIT );
+  return ptr;
+}
+
+static void setAlgorithmInternal( struct Arena * arena, enum ALGORITHM algorithm )
+{
+  arena->algorithm = algorithm;
+  arena->policy = algorithm == ADAPTIVE ? FIRST_FIT : algorithm;
+
+  // a NEXT_FIT cursor left over from an earlier run of the policy is
+  // meaningless, start the next search from the beginning
+  arena->next_fit_hole = arena->hole_head;
+
+  arena->window_allocations = 0;
+  arena->window_search_length = 0;
+  arena->window_failures = 0;
+  arena->window_largest_request = 0;
+}
+
+void mavalloc_set_algorithm( enum ALGORITHM algorithm )
+{
+  struct Arena * arena = gCurrent;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  setAlgorithmInternal( arena, algorithm );
+  unlockArenaInternal( arena );
+}
+
+enum ALGORITHM mavalloc_get_algorithm( )
+{
+  return gCurrent->policy;
+}
+
+void mavalloc_set_adaptive_limits( int window, int max_search, int max_fragmentation )
+{
+  struct Arena * arena = gCurrent;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  if( window > 0 )
+  {
+    arena->adaptive_window = window;
+  }
+  if( max_search > 0 )
+  {
+    arena->adaptive_max_search = max_search;
+  }
+  if( max_fragmentation >= 0 && max_fragmentation <= 100 )
+  {
+    arena->adaptive_max_fragmentation = max_fragmentation;
+  }
+  unlockArenaInternal( arena );
+}
+
+void mavalloc_set_segregation_threshold( size_t size )
+{
+  struct Arena * arena = gCurrent;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  arena->segregation_threshold = ALIGN4( size );
+  unlockArenaInternal( arena );
+}
+
+size_t mavalloc_largest_hole( )
+{
+  struct Arena * arena = gCurrent;
+  size_t largest = 0;
+  int i;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return 0;
+  }
+  for( i = arena->hole_head; i != -1; i = arena->ledger[i].next_hole )
+  {
+    if( (size_t)arena->ledger[i].size > largest )
+    {
+      largest = arena->ledger[i].size;
+    }
+  }
+  unlockArenaInternal( arena );
+  return largest;
+}
+
+/**
+ *
+ * \fn freeInternal(void * ptr)
+ *
+ * \brief Everything mavalloc_free does, kept apart so its many returns all
+ *        pass through the instrumentation in mavalloc_free
+ */
+static inline void freeInternal( void * ptr )
+{
+  // free the pointer passed in
+        // the pointer is of the heap memory
+    
+    // free the memory block pointed to by the pointer
+    // if the block is adjacent to another block then combine them (coalesce)
+
+    // return none
+
+  // search for the node containing the value given by ptr
+  // set that node to be a type H
+  struct Arena * arena;
+  int i;
+  int next;
+  int previous;
+
+  if( ptr == NULL )
+  {
+    return;
+  }
+
+  // the block goes back to the arena it came from, whichever thread frees it
+  arena = ownerArenaInternal( ptr );
+  if( arena == NULL || lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+
+  if( ( i = findHugeInternal( arena, ptr ) ) != -1 )
+  {
+    if( arena->huge_table[i].sampled )
+    {
+      profileFreeInternal( ptr );
+    }
+    munmap( arena->huge_table[i].address, arena->huge_table[i].length );
+    removeHugeInternal( arena, i );
+    unlockArenaInternal( arena );
+    return;
+  }
+
+  i = findBlockInternal( arena, ptr );
+  if( i == -1 )
+  {
+    unlockArenaInternal( arena );
+    return;
+  }
+
+  if( arena->ledger[i].sampled )
+  {
+    arena->ledger[i].sampled = 0;
+    profileFreeInternal( ptr );
+  }
+
+  if( arena->deferred_coalescing && arena->shared == NULL )
+  {
+    // take the size before the flush rearranges the ledger
+    long size = arena->ledger[i].size;
+
+    if( arena->quick_count == QUICK_LIST_SIZE )
+    {
+      flushQuickListInternal( arena );
+    }
+    arena->quick_list[arena->quick_count].arena = ptr;
+    arena->quick_list[arena->quick_count].size = size;
+    arena->quick_count++;
+    unlockArenaInternal( arena );
+    return;
+  }
+
+  arena->ledger[i].type = H;
+
+  // check if adjacent nodes are free
+  // if they are, then combine them
+  next = arena->ledger[i].next;
+  previous = arena->ledger[i].previous;
+  if( previous != -1 && arena->ledger[previous].type == H )
+  {
+    // combine the sizes into the previous hole
+    // remove LinkedList[i] and, if it is a hole too, the next node
+    arena->ledger[previous].size = arena->ledger[previous].size + arena->ledger[i].size;
+    if( next != -1 && arena->ledger[next].type == H )
+    {
+      arena->ledger[previous].size = arena->ledger[previous].size + arena->ledger[next].size;
+      unlinkHoleInternal( arena, next );
+      removeNodeInternal( arena, next );
+    }
+    removeNodeInternal( arena, i );
+  }
+  else if( next != -1 && arena->ledger[next].type == H )
+  {
+    // combine the sizes into LinkedList[i]
+    // remove the next node, LinkedList[i] takes its place on the hole list
+    arena->ledger[i].size = arena->ledger[i].size + arena->ledger[next].size;
+    replaceHoleInternal( arena, next, i );
+    removeNodeInternal( arena, next );
+  }
+  else if( arena->hole_tail == -1 ||
+           arena->ledger[arena->hole_tail].offset < arena->ledger[i].offset )
+  {
+    // the top of a full arena, or of everything below the last hole
+    linkHoleInternal( arena, i, arena->hole_tail );
+  }
+  else
+  {
+    // a new hole between two blocks, walk back to the hole before it
+    int hole = previous;
+
+    while( hole != -1 && arena->ledger[hole].type != H )
+    {
+      hole = arena->ledger[hole].previous;
+    }
+    linkHoleInternal( arena, i, hole );
+  }
+
+  unlockArenaInternal( arena );
+  return;
+}
+
+void mavalloc_free( void * ptr )
+{
+  LATENCY_START( );
+  PROBE1( free_entry, ptr );
+  freeInternal( ptr );
+  LATENCY_RECORD( MAVALLOC_OP_FREE, gCurrent->algorithm );
+  PROBE1( free_return, ptr );
+}
+
+int mavalloc_size( )
+{
+  // allocator size
+
+    // return the number of nodes in the allocators linked list
+
+    //return the size of the allactor linked list
+  
+  struct Arena * arena = gCurrent;
+  int number_of_nodes = 0;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return 0;
+  }
+  number_of_nodes = arena->node_count;
+  unlockArenaInternal( arena );
+  return number_of_nodes;
+}
+
+int mavalloc_owns( void * ptr )
+{
+  return ownerArenaInternal( ptr ) != NULL;
+}
+
+size_t mavalloc_usable_size( void * ptr )
+{
+  struct Arena * arena = ownerArenaInternal( ptr );
+  size_t size;
+  int i;
+
+  if( arena == NULL || lockArenaInternal( arena ) == -1 )
+  {
+    return 0;
+  }
+
+  if( ( i = findHugeInternal( arena, ptr ) ) != -1 )
+  {
+    size = arena->huge_table[i].size;
+  }
+  else
+  {
+    i = findBlockInternal( arena, ptr );
+    size = i == -1 ? 0 : arena->ledger[i].size;
+  }
+  unlockArenaInternal( arena );
+  return size;
+}
+
+void mavalloc_set_huge_threshold( size_t size )
+{
+  struct Arena * arena = gCurrent;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  arena->huge_threshold = size == 0 ? 0 : ALIGN4( size );
+  unlockArenaInternal( arena );
+}
+
+void * mavalloc_realloc( void * ptr, size_t size )
+{
+  struct Arena * arena;
+  size_t old_size;
+  void * new_ptr;
+  int slot;
+
+  if( ptr == NULL )
+  {
+    return mavalloc_alloc( size );
+  }
+  if( size == 0 )
+  {
+    mavalloc_free( ptr );
+    return NULL;
+  }
+
+  arena = ownerArenaInternal( ptr );
+  if( arena == NULL || lockArenaInternal( arena ) == -1 )
+  {
+    return NULL;
+  }
+
+  // a huge block that stays huge is remapped, the kernel moves the pages
+  // instead of copying them
+  slot = findHugeInternal( arena, ptr );
+  if( slot != -1 && ALIGN4( size ) >= arena->huge_threshold )
+  {
+    struct HugeBlock block = arena->huge_table[slot];
+    size_t length = ( ALIGN4( size ) + HUGE_ALIGNMENT - 1 ) & ~( (size_t)HUGE_ALIGNMENT - 1 );
+    LATENCY_START( );
+
+    // timed as one allocation, traced as the free and allocation it replaces
+    PROBE1( alloc_entry, size );
+    new_ptr = mremap( block.address, block.length, length, MREMAP_MAYMOVE );
+    if( new_ptr != MAP_FAILED )
+    {
+      // to the profiler this is a free and a new allocation
+      if( block.sampled )
+      {
+        profileFreeInternal( ptr );
+      }
+      removeHugeInternal( arena, slot );
+      insertHugeInternal( arena, new_ptr, ALIGN4( size ), length );
+    }
+    unlockArenaInternal( arena );
+    if( new_ptr == MAP_FAILED )
+    {
+      new_ptr = NULL;
+    }
+    else
+    {
+      PROBE1( free_entry, ptr );
+      PROBE1( free_return, ptr );
+      if( ( profile_countdown -= size ) < 0 )
+      {
+        sampleInternal( new_ptr, ALIGN4( size ) );
+      }
+    }
+    LATENCY_RECORD( MAVALLOC_OP_ALLOC, arena->algorithm );
+    PROBE3( alloc_return, new_ptr, size, arena->algorithm );
+    return new_ptr;
+  }
+  unlockArenaInternal( arena );
+
+  old_size = mavalloc_usable_size( ptr );
+  if( old_size == 0 )
+  {
+    return NULL;
+  }
+  if( ALIGN4( size ) <= old_size && slot == -1 )
+  {
+    return ptr;
+  }
+
+  new_ptr = mavalloc_alloc( size );
+  if( new_ptr == NULL )
+  {
+    return NULL;
+  }
+  memcpy( new_ptr, ptr, old_size < size ? old_size : size );
+  mavalloc_free( ptr );
+  return new_ptr;
+}
+
+size_t mavalloc_to_offset( void * ptr )
+{
+  return (char *)ptr - (char *)gCurrent->base;
+}
+
+void * mavalloc_from_offset( size_t offset )
+{
+  return (char *)gCurrent->base + offset;
+}
+
+void mavalloc_set_root( void * ptr )
+{
+  struct Arena * arena = gCurrent;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return;
+  }
+  arena->root = ptr == NULL ? -1 : (long)mavalloc_to_offset( ptr );
+  unlockArenaInternal( arena );
+}
+
+void * mavalloc_get_root( )
+{
+  struct Arena * arena = gCurrent;
+  long root;
+
+  if( lockArenaInternal( arena ) == -1 )
+  {
+    return NULL;
+  }
+  root = arena->root;
+  unlockArenaInternal( arena );
+  return root == -1 ? NULL : mavalloc_from_offset( root );
+}
+
+/* Persistent arenas.  The file starts with a header holding two complete
+ * copies of the ledger, followed by the arena itself.  Every block is recorded
+ * by its offset into the arena so the file can be mapped at any address.
+ *
+ * Crash consistency: allocations and frees only ever modify the working copy
+ * of the ledger.  mavalloc_sync() writes the arena and the working copy to
+ * disk, then flips "committed" to point at it, a single aligned int, and
+ * writes the header again.  The old committed copy becomes the new working
+ * copy.  Opening the file always restores the committed copy, so a crash at
+ * any point leaves the ledger exactly as of the last completed sync.  Only
+ * the ledger is rolled back: the arena is a shared mapping of the file and
+ * the kernel may write its pages back at any time, so the contents of blocks
+ * written after the last sync may or may not be on disk.  A block allocated
+ * after the sync is free again once the file is reopened, and one freed
+ * after it is allocated again but may hold whatever was written to it since.
+ */
+#define PERSISTENT_MAGIC    "MAVALLOC"
+#define PERSISTENT_VERSION  2
+
+struct LedgerCopy
+{
+  long root;
+  struct Node nodes[MAX_LINKED_LIST_SIZE];
+};
+
+struct PersistentHeader
+{
+  char magic[8];
+  unsigned int version;
+  int committed;
+  long size;
+  size_t arena_offset;
+  struct LedgerCopy ledger[2];
+};
+
+/**
+ *
+ * \fn validateLedgerInternal(struct Node * nodes, long size)
+ *
+ * \brief Check that a ledger read from disk describes an arena of size bytes
+ *
+ * The nodes in use must form a single list, linked the same way in both
+ * directions, that covers the arena from offset 0 without gaps or overlaps
+ * and adds up to its size.
+ *
+ * \return Number of nodes on success
+ * \return -1 if the ledger is damaged
+ */
+static int validateLedgerInternal( struct Node * nodes, long size )
+{
+  size_t offset = 0;
+  int in_use = 0;
+  int count = 0;
+  int head = -1;
+  int previous = -1;
+  int i;
+
+  for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+  {
+    if( !nodes[i].in_use )
+    {
+      continue;
+    }
+    in_use++;
+    if( nodes[i].previous == -1 )
+    {
+      if( head != -1 )
+      {
+        return -1;
+      }
+      head = i;
+    }
+  }
+
+  // a cycle is caught by running past the number of nodes in use
+  for( i = head; i != -1; i = nodes[i].next )
+  {
+    if( i < 0 || i >= MAX_LINKED_LIST_SIZE || !nodes[i].in_use || count == in_use ||
+        nodes[i].previous != previous || nodes[i].offset != offset || nodes[i].size <= 0 ||
+        ( nodes[i].type != P && nodes[i].type != H ) )
+    {
+      return -1;
+    }
+    offset += nodes[i].size;
+    previous = i;
+    count++;
+  }
+  return count > 0 && count == in_use && offset == (size_t)size ? count : -1;
+}
+
+int mavalloc_open_persistent( const char * path, size_t size, enum ALGORITHM algorithm )
+{
+  struct Arena * arena = processArenaInternal( );
+  struct PersistentHeader * header;
+  size_t header_size;
+  size_t length;
+  struct stat st;
+  int created = 0;
+  int fd;
+
+  header_size = ( sizeof( struct PersistentHeader ) + sysconf( _SC_PAGESIZE ) - 1 ) &
+                ~( (size_t)sysconf( _SC_PAGESIZE ) - 1 );
+
+  fd = open( path, O_RDWR | O_CREAT, 0644 );
+  if( fd == -1 )
+  {
+    return -1;
+  }
+  if( fstat( fd, &st ) == -1 )
+  {
+    close( fd );
+    return -1;
+  }
+
+  // a new or empty file gets a fresh arena, an existing one keeps its size
+  if( st.st_size == 0 )
+  {
+    length = header_size + ALIGN4( size );
+    if( ftruncate( fd, length ) == -1 )
+    {
+      close( fd );
+      return -1;
+    }
+    created = 1;
+  }
+  else
+  {
+    length = st.st_size;
+  }
+
+  header = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  if( header == MAP_FAILED )
+  {
+    close( fd );
+    return -1;
+  }
+
+  if( created )
+  {
+    memcpy( header->magic, PERSISTENT_MAGIC, sizeof( header->magic ) );
+    header->version = PERSISTENT_VERSION;
+    header->size = ALIGN4( size );
+    header->arena_offset = header_size;
+    header->committed = 0;
+
+    arena->ledger = header->ledger[0].nodes;
+    resetLedgerInternal( arena, header->size );
+    header->ledger[0].root = -1;
+    memcpy( &header->ledger[1], &header->ledger[0], sizeof( struct LedgerCopy ) );
+    arena->ledger = header->ledger[1].nodes;
+    msync( header, header_size, MS_SYNC );
+  }
+  else
+  {
+    struct LedgerCopy * committed = &header->ledger[ header->committed == 1 ];
+
+    if( memcmp( header->magic, PERSISTENT_MAGIC, sizeof( header->magic ) ) != 0 ||
+        header->version != PERSISTENT_VERSION ||
+        ( header->committed != 0 && header->committed != 1 ) ||
+        header->arena_offset != header_size ||
+        header->size <= 0 || header_size + header->size != length ||
+        validateLedgerInternal( committed->nodes, header->size ) == -1 )
+    {
+      munmap( header, length );
+      close( fd );
+      return -1;
+    }
+
+    // throw away whatever the working copy held when the file was last used
+    memcpy( &header->ledger[ !header->committed ], committed, sizeof( struct LedgerCopy ) );
+    arena->ledger = header->ledger[ !header->committed ].nodes;
+
+    arena->size = header->size;
+    loadLedgerInternal( arena );
+    arena->quick_count = 0;
+    arena->root = committed->root;
+  }
+
+  arena->persistent = header;
+  arena->persistent_length = length;
+  arena->persistent_fd = fd;
+  arena->base = (char *)header + header->arena_offset;
+
+  setAlgorithmInternal( arena, algorithm );
+  return 0;
+}
+
+int mavalloc_sync( )
+{
+  struct Arena * arena = gCurrent;
+  struct PersistentHeader * header = arena->persistent;
+  int working;
+
+  if( header == NULL )
+  {
+    return 0;
+  }
+
+  // blocks parked for deferred coalescing are free, do not commit them as
+  // allocated
+  flushQuickListInternal( arena );
+
+  working = !header->committed;
+  header->ledger[working].root = arena->root;
+
+  // arena contents and the working ledger must be on disk before the flip
+  if( msync( header, arena->persistent_length, MS_SYNC ) == -1 )
+  {
+    return -1;
+  }
+
+  header->committed = working;
+  if( msync( header, sizeof( struct PersistentHeader ), MS_SYNC ) == -1 )
+  {
+    return -1;
+  }
+
+  // continue in the other copy so the one just committed is never touched
+  memcpy( &header->ledger[ !working ], &header->ledger[working], sizeof( struct LedgerCopy ) );
+  arena->ledger = header->ledger[ !working ].nodes;
+  return 0;
+}
+
+/* Snapshots.  fork() gives the child a copy-on-write image of the whole
+ * process, so the child sees the arena and ledger frozen at the moment of
+ * the call while the parent keeps allocating.  Only page tables are copied
+ * up front; a page is duplicated the first time the parent writes to it
+ * while the child is still running.  The child writes the image out in the
+ * persistent arena format and exits.
+ */
+
+static int writeAllInternal( int fd, const void * data, size_t length )
+{
+  const char * next = data;
+
+  while( length > 0 )
+  {
+    ssize_t written = write( fd, next, length );
+    if( written <= 0 )
+    {
+      return -1;
+    }
+    next += written;
+    length -= written;
+  }
+  return 0;
+}
+
+/* Runs in the snapshot child.  Only async-signal-safe calls from here on,
+ * another thread of the parent may have held a lock at the fork, so
+ * header_size is worked out before the fork and the quick list is not
+ * flushed, its sort may allocate.
+ */
+static int writeSnapshotInternal( struct Arena * arena, int fd, size_t header_size )
+{
+  struct PersistentHeader * header;
+  struct Node * nodes;
+  int i, j;
+
+  header = mmap( NULL, header_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( header == MAP_FAILED )
+  {
+    return -1;
+  }
+
+  memcpy( header->magic, PERSISTENT_MAGIC, sizeof( header->magic ) );
+  header->version = PERSISTENT_VERSION;
+  header->committed = 0;
+  header->size = arena->size;
+  header->arena_offset = header_size;
+  header->ledger[0].root = arena->root;
+  nodes = header->ledger[0].nodes;
+  memcpy( nodes, arena->ledger, sizeof( header->ledger[0].nodes ) );
+
+  // parked blocks are free, the copy says so by turning each into a hole
+  // and merging every run of holes into its first node.  The hole links
+  // and free entries are rebuilt when the snapshot is opened.
+  for( j = 0; j < arena->quick_count; j++ )
+  {
+    size_t offset = (char *)arena->quick_list[j].arena - (char *)arena->base;
+
+    for( i = 0; i < MAX_LINKED_LIST_SIZE; i++ )
+    {
+      if( nodes[i].in_use && nodes[i].offset == offset )
+      {
+        nodes[i].type = H;
+        break;
+      }
+    }
+  }
+  for( i = arena->head; i != -1; i = nodes[i].next )
+  {
+    while( nodes[i].type == H && nodes[i].next != -1 && nodes[ nodes[i].next ].type == H )
+    {
+      int next = nodes[i].next;
+
+      nodes[i].size += nodes[next].size;
+      nodes[i].next = nodes[next].next;
+      if( nodes[i].next != -1 )
+      {
+        nodes[ nodes[i].next ].previous = i;
+      }
+      nodes[next].in_use = 0;
+    }
+  }
+  memcpy( &header->ledger[1], &header->ledger[0], sizeof( struct LedgerCopy ) );
+
+  if( writeAllInternal( fd, header, header_size ) == -1 ||
+      writeAllInternal( fd, arena->base, arena->size ) == -1 )
+  {
+    return -1;
+  }
+  return 0;
+}
+
+int mavalloc_snapshot( int fd )
+{
+  struct Arena * arena = gCurrent;
+  size_t header_size;
+  pid_t pid;
+
+  // a persistent or shared arena is a shared mapping and would not be
+  // frozen in the child, mavalloc_sync is the checkpoint of a persistent one
+  if( arena->base == NULL || arena->persistent != NULL || arena->shared != NULL )
+  {
+    return -1;
+  }
+
+  header_size = ( sizeof( struct PersistentHeader ) + sysconf( _SC_PAGESIZE ) - 1 ) &
+                ~( (size_t)sysconf( _SC_PAGESIZE ) - 1 );
+
+  // the other threads of a node arena must not be part way through an
+  // operation on the ledger the child copies
+  lockArenaInternal( arena );
+  pid = fork( );
+  if( pid == 0 )
+  {
+    _exit( writeSnapshotInternal( arena, fd, header_size ) == 0 ? 0 : 1 );
+  }
+  unlockArenaInternal( arena );
+  return pid;
+}
+
+int mavalloc_snapshot_wait( int snapshot )
+{
+  int status;
+
+  while( waitpid( snapshot, &status, 0 ) == -1 )
+  {
+    if( errno != EINTR )
+    {
+      return -1;
+    }
+  }
+  return WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ? 0 : -1;
+}
+
+int mavalloc_init_shared( const char * name, size_t size, enum ALGORITHM algorithm )
+{
+  struct Arena * arena = processArenaInternal( );
+  struct SharedHeader * header;
+  size_t header_size;
+  size_t length;
+  struct stat st;
+  int created = 0;
+  int tries;
+  int fd;
+
+  header_size = ( sizeof( struct SharedHeader ) + sysconf( _SC_PAGESIZE ) - 1 ) &
+                ~( (size_t)sysconf( _SC_PAGESIZE ) - 1 );
+
+  // whoever creates the object sets it up, everyone else attaches
+  fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+  if( fd != -1 )
+  {
+    created = 1;
+    length = header_size + ALIGN4( size );
+    if( ftruncate( fd, length ) == -1 )
+    {
+      close( fd );
+      shm_unlink( name );
+      return -1;
+    }
+  }
+  else
+  {
+    if( errno != EEXIST || ( fd = shm_open( name, O_RDWR, 0 ) ) == -1 )
+    {
+      return -1;
+    }
+
+    // the creator may not have sized the object yet
+    for( tries = 0; ; tries++ )
+    {
+      if( fstat( fd, &st ) == -1 || tries == 1000 )
+      {
+        close( fd );
+        return -1;
+      }
+      if( st.st_size != 0 )
+      {
+        break;
+      }
+      usleep( 1000 );
+    }
+    length = st.st_size;
+  }
+
+  header = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( header == MAP_FAILED )
+  {
+    if( created )
+    {
+      shm_unlink( name );
+    }
+    return -1;
+  }
+
+  if( created )
+  {
+    pthread_mutexattr_t attr;
+
+    memcpy( header->magic, SHARED_MAGIC, sizeof( header->magic ) );
+    header->version = SHARED_VERSION;
+    header->broken = 0;
+    header->size = ALIGN4( size );
+    header->arena_offset = header_size;
+
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    pthread_mutex_init( &header->lock, &attr );
+    pthread_mutexattr_destroy( &attr );
+
+    arena->ledger = header->nodes;
+    resetLedgerInternal( arena, header->size );
+    header->head = arena->head;
+    header->tail = arena->tail;
+    header->free_slot = arena->free_slot;
+    header->node_count = arena->node_count;
+    header->high_water = arena->high_water;
+    header->hole_head = arena->hole_head;
+    header->hole_tail = arena->hole_tail;
+    header->next_fit_hole = arena->hole_head;
+    header->root = -1;
+
+    // publish the header only once everything above is in place
+    __atomic_store_n( &header->ready, 1, __ATOMIC_RELEASE );
+  }
+  else
+  {
+    for( tries = 0; !__atomic_load_n( &header->ready, __ATOMIC_ACQUIRE ); tries++ )
+    {
+      if( tries == 1000 )
+      {
+        munmap( header, length );
+        return -1;
+      }
+      usleep( 1000 );
+    }
+
+    if( memcmp( header->magic, SHARED_MAGIC, sizeof( header->magic ) ) != 0 ||
+        header->version != SHARED_VERSION ||
+        header->arena_offset != header_size ||
+        header->size <= 0 || header_size + header->size != length )
+    {
+      munmap( header, length );
+      return -1;
+    }
+
+    arena->ledger = header->nodes;
+    arena->size = header->size;
+    arena->initialized = 1;
+    arena->quick_count = 0;
+  }
+
+  arena->shared = header;
+  arena->shared_length = length;
+  arena->base = (char *)header + header->arena_offset;
+
+  setAlgorithmInternal( arena, algorithm );
+  return 0;
+}
+
+/* NUMA arenas.  The arena is mapped rather than malloc()ed and bound to a
+ * node before any page of it is touched, so every page is allocated on that
+ * node whichever thread first writes to it.  mbind and getcpu are called
+ * through syscall() so the library does not depend on libnuma.  A kernel
+ * without NUMA support, or a node that does not exist, leaves the arena
+ * unbound and otherwise working as usual.
+ */
+#define NUMA_MPOL_BIND      2
+#define NUMA_MPOL_MF_MOVE   ( 1 << 1 )
+
+/**
+ *
+ * \fn bindToNodeInternal(void * address, size_t length, int node)
+ *
+ * \brief Place the pages of a mapping on node
+ *
+ * \return 0 on success
+ * \return -1 if the kernel could not bind them
+ */
+static int bindToNodeInternal( void * address, size_t length, int node )
+{
+#ifdef SYS_mbind
+  unsigned long mask[ NUMA_MAX_NODES / ( 8 * sizeof( unsigned long ) ) ];
+
+  if( node < 0 || node >= NUMA_MAX_NODES )
+  {
+    return -1;
+  }
+
+  memset( mask, 0, sizeof( mask ) );
+  mask[ node / ( 8 * sizeof( unsigned long ) ) ] = 1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+
+  // the kernel reads one bit less than maxnode
+  if( syscall( SYS_mbind, address, length, NUMA_MPOL_BIND, mask, NUMA_MAX_NODES + 1,
+               NUMA_MPOL_MF_MOVE ) == 0 )
+  {
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+/* The node of the CPU the calling thread is running on, 0 if unknown */
+static int currentNodeInternal( )
+{
+#ifdef SYS_getcpu
+  unsigned int cpu, node;
+
+  if( syscall( SYS_getcpu, &cpu, &node, NULL ) == 0 )
+  {
+    return node;
+  }
+#endif
+  return 0;
+}
+
+/**
+ *
+ * \fn mapArenaInternal(struct Arena * arena, size_t size, enum ALGORITHM algorithm, int node)
+ *
+ * \brief Map the arena's space and bind it to node
+ *
+ * \return 0 on success
+ * \return -1 if the space could not be mapped
+ */
+static int mapArenaInternal( struct Arena * arena, size_t size, enum ALGORITHM algorithm, int node )
+{
+  size_t length = ( ALIGN4( size ) + sysconf( _SC_PAGESIZE ) - 1 ) &
+                  ~( (size_t)sysconf( _SC_PAGESIZE ) - 1 );
+  void * base;
+
+  base = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( base == MAP_FAILED )
+  {
+    return -1;
+  }
+
+  arena->ledger = arena->private_ledger;
+  arena->base = base;
+  arena->mapped_length = length;
+  arena->numa_node = bindToNodeInternal( base, length, node ) == 0 ? node : -1;
+
+  setAlgorithmInternal( arena, algorithm );
+  resetLedgerInternal( arena, ALIGN4( size ) );
+  return 0;
+}
+
+int mavalloc_init_numa( size_t size, enum ALGORITHM algorithm, int node )
+{
+  struct Arena * arena = processArenaInternal( );
+
+  if( node < 0 )
+  {
+    node = currentNodeInternal( );
+  }
+  return mapArenaInternal( arena, size, algorithm, node );
+}
+
+/* Node arenas.  mavalloc_init_thread() attaches the calling thread to the
+ * arena of the node it is running on, the first thread on a node creates it.
+ * The threads of a node share the arena, so every operation on it takes its
+ * lock.  A node arena is one mapping holding its struct Arena followed by its
+ * ledger, both placed on the node, and it is never unmapped: a block may be
+ * freed by any thread, long after the one that allocated it is gone.
+ *
+ * A thread detaches with mavalloc_destroy() or, failing that, when it exits.
+ * Once the last thread has detached from an arena with nothing allocated in
+ * it the arena's pages go back to the kernel.  The mapping stays bound to
+ * the node and the next thread to attach faults them in again.
+ */
+static pthread_mutex_t node_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+static size_t nodeArenaHeaderInternal( )
+{
+  return ( sizeof( struct Arena ) + sysconf( _SC_PAGESIZE ) - 1 ) &
+         ~( (size_t)sysconf( _SC_PAGESIZE ) - 1 );
+}
+
+static size_t nodeArenaLengthInternal( )
+{
+  return nodeArenaHeaderInternal( ) + sizeof( struct Node ) * MAX_LINKED_LIST_SIZE;
+}
+
+/**
+ *
+ * \fn createNodeArenaInternal(size_t size, enum ALGORITHM algorithm, int node)
+ *
+ * \brief Map and set up the arena of node
+ *
+ * \return The arena on success
+ * \return NULL if it could not be mapped
+ */
+static struct Arena * createNodeArenaInternal( size_t size, enum ALGORITHM algorithm, int node )
+{
+  size_t length = nodeArenaLengthInternal( );
+  struct Arena * arena;
+
+  arena = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( arena == MAP_FAILED )
+  {
+    return NULL;
+  }
+  bindToNodeInternal( arena, length, node );
+
+  *arena = EmptyArena;
+  arena->private_ledger = (struct Node *)( (char *)arena + nodeArenaHeaderInternal( ) );
+  if( mapArenaInternal( arena, size, algorithm, node ) != 0 )
+  {
+    munmap( arena, length );
+    return NULL;
+  }
+  pthread_mutex_init( &arena->lock, NULL );
+  arena->thread_safe = 1;
+  return arena;
+}
+
+/**
+ *
+ * \fn releaseNodeArenaInternal(void * node_arena)
+ *
+ * \brief Count a thread off a node arena
+ *
+ * Also the destructor of thread_key, which runs when a thread that is still
+ * attached exits.
+ */
+static void releaseNodeArenaInternal( void * node_arena )
+{
+  struct Arena * arena = node_arena;
+
+  pthread_mutex_lock( &arena->lock );
+  if( --arena->threads == 0 )
+  {
+    flushQuickListInternal( arena );
+    if( arena->node_count == 1 && arena->ledger[ arena->head ].type == H )
+    {
+      madvise( arena->base, arena->mapped_length, MADV_DONTNEED );
+    }
+  }
+  pthread_mutex_unlock( &arena->lock );
+}
+
+static void createThreadKeyInternal( )
+{
+  pthread_key_create( &thread_key, releaseNodeArenaInternal );
+}
+
+/* Put the calling thread back on the process wide arena */
+static void detachThreadInternal( )
+{
+  struct Arena * arena = gCurrent;
+
+  gCurrent = &DefaultArena;
+  pthread_setspecific( thread_key, NULL );
+  releaseNodeArenaInternal( arena );
+}
+
+/* The arena mavalloc_init() and the other initializers set up.  A thread
+ * attached to a node arena is detached first, the node arena belongs to
+ * every thread of the node and is never set up again.
+ */
+static struct Arena * processArenaInternal( )
+{
+  if( gCurrent->thread_safe )
+  {
+    detachThreadInternal( );
+  }
+  return gCurrent;
+}
+
+int mavalloc_init_thread( size_t size, enum ALGORITHM algorithm )
+{
+  int node = currentNodeInternal( );
+  struct Arena * arena;
+
+  if( node < 0 || node >= NUMA_MAX_NODES )
+  {
+    node = 0;
+  }
+  pthread_once( &thread_key_once, createThreadKeyInternal );
+
+  arena = __atomic_load_n( &NodeArenas[node], __ATOMIC_ACQUIRE );
+  if( arena == NULL )
+  {
+    pthread_mutex_lock( &node_arena_lock );
+    arena = NodeArenas[node];
+    if( arena == NULL && ( arena = createNodeArenaInternal( size, algorithm, node ) ) != NULL )
+    {
+      __atomic_store_n( &NodeArenas[node], arena, __ATOMIC_RELEASE );
+      if( node >= node_arena_limit )
+      {
+        __atomic_store_n( &node_arena_limit, node + 1, __ATOMIC_RELEASE );
+      }
+    }
+    pthread_mutex_unlock( &node_arena_lock );
+    if( arena == NULL )
+    {
+      return -1;
+    }
+  }
+
+  if( gCurrent == arena )
+  {
+    return 0;
+  }
+  if( gCurrent->thread_safe )
+  {
+    detachThreadInternal( );
+  }
+
+  pthread_mutex_lock( &arena->lock );
+  arena->threads++;
+  pthread_mutex_unlock( &arena->lock );
+  gCurrent = arena;
+  pthread_setspecific( thread_key, arena );
+  return 0;
+}
+
+int mavalloc_numa_node( )
+{
+  return gCurrent->numa_node;
 }
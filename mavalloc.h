@@ -0,0 +1,419 @@
+#ifndef MAVALLOC_H
+#define MAVALLOC_H
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ALGORITHM
+{
+  FIRST_FIT = 0,
+  NEXT_FIT,
+  BEST_FIT,
+  WORST_FIT,
+  ADAPTIVE,
+  SEGREGATED
+};
+
+enum MAVALLOC_OPERATION
+{
+  MAVALLOC_OP_ALLOC = 0,
+  MAVALLOC_OP_FREE
+};
+
+/* Latency histogram bucket b counts operations that took 2^b to 2^(b+1)
+ * cycles, bucket 0 also counts those that took none */
+#define MAVALLOC_LATENCY_BUCKETS  64
+
+#define ALIGN4(s)         (((((s) - 1) >> 2) << 2) + 4)
+
+/**
+ * \brief Initialize the allocation arena and set the algorithm type
+ *
+ * \param size The size of the arena in bytes, rounded up to a multiple of 4
+ * \param algorithm The placement policy used by mavalloc_alloc
+ *
+ * \return 0 on success
+ * \return -1 if the arena could not be allocated
+ */
+int mavalloc_init( size_t size, enum ALGORITHM algorithm );
+
+/**
+ * \brief Release the arena and reset the ledger
+ *
+ * Called from a thread attached to a node arena, see mavalloc_init_thread(),
+ * it only detaches the thread, which goes back to the process wide arena.
+ * The node arena and the blocks in it stay.
+ */
+void mavalloc_destroy( );
+
+/**
+ * \brief Allocate size bytes from the arena
+ *
+ * \return Pointer to the block, NULL if no hole is large enough or the
+ *         ledger is full
+ */
+void * mavalloc_alloc( size_t size );
+
+/**
+ * \brief Allocate size bytes using FIRST_FIT whatever the current algorithm
+ *
+ * Each placement policy has its own copy of the allocation path with the
+ * policy fixed when the library is compiled.  Code that always wants the same
+ * policy can call its copy directly and skip the dispatch in mavalloc_alloc,
+ * which only selects one of these.  Blocks from all of them are released
+ * with mavalloc_free.
+ */
+void * mavalloc_alloc_first_fit( size_t size );
+
+/**
+ * \brief Allocate size bytes using NEXT_FIT whatever the current algorithm
+ */
+void * mavalloc_alloc_next_fit( size_t size );
+
+/**
+ * \brief Allocate size bytes using BEST_FIT whatever the current algorithm
+ */
+void * mavalloc_alloc_best_fit( size_t size );
+
+/**
+ * \brief Allocate size bytes using WORST_FIT whatever the current algorithm
+ */
+void * mavalloc_alloc_worst_fit( size_t size );
+
+/**
+ * \brief Allocate size bytes using ADAPTIVE whatever the current algorithm
+ */
+void * mavalloc_alloc_adaptive( size_t size );
+
+/**
+ * \brief Allocate size bytes using SEGREGATED whatever the current algorithm
+ */
+void * mavalloc_alloc_segregated( size_t size );
+
+/**
+ * \brief Allocate size bytes at an address that is a multiple of alignment
+ *
+ * alignment must be a power of two.  Requests aligned to more than 4 bytes
+ * take the lowest hole that has room once the start is rounded up, whatever
+ * the current algorithm, and the bytes skipped are added to the block before
+ * them.  Released with mavalloc_free.
+ *
+ * \return Pointer to the block, NULL if nothing fits or alignment is not a
+ *         power of two
+ */
+void * mavalloc_alloc_aligned( size_t size, size_t alignment );
+
+/**
+ * \brief Return a block to the arena and coalesce it with neighbouring holes
+ */
+void mavalloc_free( void * ptr );
+
+/**
+ * \brief Number of nodes, allocated blocks and holes, in the ledger
+ */
+int mavalloc_size( );
+
+/**
+ * \brief Change the placement policy
+ *
+ * Safe to call between any two allocations.  ADAPTIVE picks between
+ * FIRST_FIT, NEXT_FIT and BEST_FIT from the recent search lengths and
+ * fragmentation.  SEGREGATED places requests below the segregation threshold
+ * in the lowest hole that fits and larger ones at the top of the highest, so
+ * long-lived small blocks do not end up scattered between the large ones.
+ */
+void mavalloc_set_algorithm( enum ALGORITHM algorithm );
+
+/**
+ * \brief The policy serving the next allocation
+ *
+ * Same as the configured algorithm, except in ADAPTIVE mode where it is the
+ * policy currently chosen.
+ */
+enum ALGORITHM mavalloc_get_algorithm( );
+
+/**
+ * \brief Tune ADAPTIVE mode
+ *
+ * \param window Allocations between two policy decisions, 256 by default
+ * \param max_search Average ledger nodes searched per allocation above which
+ *        NEXT_FIT is preferred over FIRST_FIT.  FIRST_FIT is always used while
+ *        the ledger holds no more nodes than this.  64 by default
+ * \param max_fragmentation Limit, in percent, on the share of the free space
+ *        held in holes too small for the largest request of the window.
+ *        Above it, or after a failed allocation, BEST_FIT is used until the
+ *        share falls to half the limit.  50 by default
+ *
+ * Out of range values leave the current setting unchanged.
+ */
+void mavalloc_set_adaptive_limits( int window, int max_search, int max_fragmentation );
+
+/**
+ * \brief Turn deferred coalescing on or off
+ *
+ * While on, freed blocks are parked on a small list keyed by their exact size
+ * and handed straight back to the next allocation of that size.  They are
+ * merged into the arena in batches, when the list overflows or an allocation
+ * would fail.  Turning it off merges everything still parked.
+ */
+void mavalloc_set_deferred_coalescing( int enabled );
+
+/**
+ * \brief Size from which SEGREGATED places requests at the high end
+ *
+ * Requests smaller than size are served from the low end of the arena.  The
+ * default is 4096 bytes.
+ */
+void mavalloc_set_segregation_threshold( size_t size );
+
+/**
+ * \brief Size of the largest hole in the arena
+ *
+ * The largest request the arena can still satisfy, the usual measure of how
+ * badly the free space is fragmented.  Scans the whole ledger.
+ */
+size_t mavalloc_largest_hole( );
+
+/**
+ * \brief Whether ptr points into one of the process's arenas or is a huge
+ *        block of one
+ *
+ * A range check per arena and a table lookup, used to route frees when
+ * mavalloc runs next to another allocator.
+ */
+int mavalloc_owns( void * ptr );
+
+/**
+ * \brief Size of the allocated block starting at ptr
+ *
+ * \return The block size in bytes, 0 if ptr is not an allocated block
+ */
+size_t mavalloc_usable_size( void * ptr );
+
+/**
+ * \brief Serve requests of at least size bytes outside the arena
+ *
+ * Each such request gets its own anonymous mapping, which mavalloc_free()
+ * unmaps.  They take no ledger entry and leave no hole in the arena.  0, the
+ * default, turns this off.  Only arenas created with mavalloc_init use it,
+ * and huge blocks are not part of a snapshot.
+ */
+void mavalloc_set_huge_threshold( size_t size );
+
+/**
+ * \brief Resize the block at ptr, moving it if necessary
+ *
+ * Huge blocks are resized with mremap and are never copied.  Behaves like
+ * mavalloc_alloc() for a NULL ptr and like mavalloc_free() for a size of 0.
+ *
+ * \return Pointer to the resized block, NULL if it could not be resized, in
+ *         which case ptr is left as it was
+ */
+void * mavalloc_realloc( void * ptr, size_t size );
+
+/**
+ * \brief Offset of ptr from the start of the arena
+ *
+ * Offsets stay meaningful when the arena is mapped at a different address,
+ * pointers into a persistent arena should be stored as offsets.
+ */
+size_t mavalloc_to_offset( void * ptr );
+
+/**
+ * \brief Pointer to the byte at offset in the arena
+ */
+void * mavalloc_from_offset( size_t offset );
+
+/**
+ * \brief Record the application's root object, NULL to clear it
+ *
+ * For persistent arenas the root is saved with the ledger and is the entry
+ * point to the data after a restart.
+ */
+void mavalloc_set_root( void * ptr );
+
+/**
+ * \brief The root object set with mavalloc_set_root, NULL if none
+ */
+void * mavalloc_get_root( );
+
+/**
+ * \brief Open or create a file backed arena
+ *
+ * A missing or empty file is sized to hold size bytes of arena plus the
+ * ledger and starts out empty.  An existing file is mapped as it is, its
+ * allocations and root are restored from the last mavalloc_sync() and size
+ * is ignored.  mavalloc_destroy() syncs and closes the file.
+ *
+ * \return 0 on success
+ * \return -1 if the file can not be opened or is not a valid arena
+ */
+int mavalloc_open_persistent( const char * path, size_t size, enum ALGORITHM algorithm );
+
+/**
+ * \brief Checkpoint a persistent arena
+ *
+ * Writes the arena contents and ledger to disk and makes the ledger the one
+ * the next mavalloc_open_persistent() restores.  Block contents are not
+ * rolled back: the arena is a shared mapping of the file, so data written
+ * after the last sync may already be on disk.  Does nothing for arenas
+ * created with mavalloc_init.
+ *
+ * \return 0 on success
+ * \return -1 if the data could not be written
+ */
+int mavalloc_sync( );
+
+/**
+ * \brief Take a copy-on-write snapshot of the arena and write it to fd
+ *
+ * Forks a child process that sees the arena and ledger exactly as they are
+ * at the time of the call and writes them to fd in the persistent arena
+ * format, so the result can be reopened with mavalloc_open_persistent().  The
+ * call returns as soon as the child exists and the caller keeps allocating;
+ * pages it writes to are copied while the snapshot is still being written.
+ *
+ * Not available for persistent arenas, use mavalloc_sync() for those.
+ *
+ * \return The snapshot's process id, to pass to mavalloc_snapshot_wait()
+ * \return -1 on failure
+ */
+int mavalloc_snapshot( int fd );
+
+/**
+ * \brief Wait until a snapshot has been written
+ *
+ * \return 0 if the whole snapshot was written
+ * \return -1 if writing it failed
+ */
+int mavalloc_snapshot_wait( int snapshot );
+
+/**
+ * \brief Create or attach to an arena in POSIX shared memory
+ *
+ * The first process to call this with a given name creates the shared memory
+ * object, sized for size bytes of arena plus the ledger.  Later callers
+ * attach to it and size is ignored.  All of them allocate from and free to
+ * the same arena, a block allocated in one process may be freed in another.
+ * Pass blocks between processes with mavalloc_to_offset() and
+ * mavalloc_from_offset(), each process maps the arena at its own address.
+ *
+ * Every operation takes a process-shared robust lock.  Deferred coalescing
+ * has no effect on a shared arena.  mavalloc_destroy() detaches the calling
+ * process; remove the object with shm_unlink(name) once nobody needs it.
+ *
+ * \return 0 on success
+ * \return -1 if the object can not be created or is not a valid arena
+ */
+int mavalloc_init_shared( const char * name, size_t size, enum ALGORITHM algorithm );
+
+/**
+ * \brief Initialize the arena with its pages placed on a NUMA node
+ *
+ * Same as mavalloc_init, except that the arena is mapped and bound to node
+ * before it is touched.  A node of -1 means the node the caller is running
+ * on.  On a kernel without NUMA support, or if node does not exist, the
+ * arena is left unbound and works as usual.
+ *
+ * \return 0 on success
+ * \return -1 if the arena could not be allocated
+ */
+int mavalloc_init_numa( size_t size, enum ALGORITHM algorithm, int node );
+
+/**
+ * \brief Attach the calling thread to the arena of its current node
+ *
+ * Until then every thread works on the one process wide arena.  Afterwards
+ * all mavalloc calls made by this thread use the arena of the node it is
+ * running on, which with its ledger is placed on that node.  The first
+ * thread on a node creates the arena with size and algorithm, later ones
+ * share it and the arguments are ignored.  Every operation on a node arena
+ * takes its lock.
+ *
+ * Any thread may free a block, mavalloc_free() returns it to the arena it
+ * came from.  mavalloc_destroy() detaches the thread, as does the thread
+ * exiting.  A node arena lasts as long as the process; once no thread is
+ * attached and nothing is allocated in it its pages go back to the kernel.
+ * Calling mavalloc_init() or another initializer detaches the thread and
+ * sets up the process wide arena.
+ *
+ * \return 0 on success
+ * \return -1 if the arena could not be allocated
+ */
+int mavalloc_init_thread( size_t size, enum ALGORITHM algorithm );
+
+/**
+ * \brief The NUMA node the calling thread's arena is bound to
+ *
+ * \return The node, -1 if the arena is not bound to one
+ */
+int mavalloc_numa_node( );
+
+/**
+ * \brief Start sampling allocations for a heap profile
+ *
+ * On average one allocation per sample_period bytes allocated has its call
+ * stack recorded, 0 selects the default of 512 KB.  Each call site keeps the
+ * bytes and objects it allocated in total and those still live.  Starting
+ * again clears the profile.  While the profiler is off allocations pay for
+ * one decrement.
+ *
+ * \return 0 on success
+ */
+int mavalloc_profile_start( size_t sample_period );
+
+/**
+ * \brief Stop sampling and discard the profile
+ */
+void mavalloc_profile_stop( );
+
+/**
+ * \brief Write the heap profile to path
+ *
+ * The file is in the legacy heap profile format read by pprof, for example
+ * pprof --inuse_space program path, or --alloc_space for every byte
+ * allocated since mavalloc_profile_start().  The profile keeps up to 768
+ * call sites and 6144 live samples, samples taken past either limit are
+ * left out and their count is written on a '#' comment line, which pprof
+ * skips.
+ *
+ * \return 0 on success
+ * \return -1 if the file could not be written
+ */
+int mavalloc_profile_dump( const char * path );
+
+/**
+ * \brief Copy the latency histogram of one operation and placement policy
+ *
+ * Only available when mavalloc.c is compiled with -DMAVALLOC_STATS.  Each
+ * mavalloc_alloc and mavalloc_free call, and each call to one of the fixed
+ * policy allocators or mavalloc_alloc_aligned, is timed with the cycle
+ * counter.  realloc is counted as the allocation and free it is made of, or
+ * as one allocation when a huge block is remapped.  Allocations are filed
+ * under the policy that served them, ADAPTIVE for the adaptive policy
+ * whatever it chose and FIRST_FIT for aligned requests, and frees under the
+ * arena's algorithm.
+ *
+ * \param counts Receives MAVALLOC_LATENCY_BUCKETS counts, see
+ *        MAVALLOC_LATENCY_BUCKETS for what each one holds
+ *
+ * \return 0 on success
+ * \return -1 if the statistics are compiled out or an argument is out of
+ *         range
+ */
+int mavalloc_latency_histogram( enum MAVALLOC_OPERATION operation, enum ALGORITHM algorithm,
+                                unsigned long counts[MAVALLOC_LATENCY_BUCKETS] );
+
+/**
+ * \brief Clear every latency histogram
+ */
+void mavalloc_latency_reset( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef MAVALLOC_HPP
+#define MAVALLOC_HPP
+
+/**
+ * C++ access to mavalloc arenas.
+ *
+ *   mavalloc_resource             std::pmr::memory_resource over the arena
+ *   mavalloc_monotonic_resource   bump allocation from arena chunks, nothing
+ *                                 is released until the resource is
+ *   mavalloc_allocator<T>         allocator for the standard containers
+ *
+ * All of them allocate from the arena of the calling thread, see
+ * mavalloc_init() and mavalloc_init_thread().  The arena must already be
+ * initialized; a request it can not satisfy throws std::bad_alloc.
+ *
+ * Requests aligned to more than 4 bytes go through mavalloc_alloc_aligned(),
+ * which always takes the lowest hole that fits.  The arena's algorithm,
+ * ADAPTIVE included, only places the others, and ADAPTIVE does not count
+ * aligned requests towards its choice of policy.
+ *
+ * Compile mavalloc.c as C and link it in:
+ *
+ *   gcc -O2 -c mavalloc.c
+ *   g++ -O2 -std=c++17 -o program program.cpp mavalloc.o
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include "mavalloc.h"
+
+/**
+ * \brief Allocate the request, honouring alignments above the arena's 4
+ */
+inline void * mavalloc_allocate_or_throw( std::size_t bytes, std::size_t alignment )
+{
+  void * ptr = alignment <= 4 ? mavalloc_alloc( bytes ) : mavalloc_alloc_aligned( bytes, alignment );
+
+  if( ptr == nullptr )
+  {
+    throw std::bad_alloc( );
+  }
+  return ptr;
+}
+
+/**
+ * \brief Memory resource handing out and releasing blocks one by one
+ *
+ * The resource holds no state, every instance is interchangeable with every
+ * other and compares equal to it.
+ */
+class mavalloc_resource : public std::pmr::memory_resource
+{
+protected:
+  void * do_allocate( std::size_t bytes, std::size_t alignment ) override
+  {
+    // the arena has no zero sized blocks
+    return mavalloc_allocate_or_throw( bytes == 0 ? 1 : bytes, alignment );
+  }
+
+  void do_deallocate( void * ptr, std::size_t, std::size_t ) override
+  {
+    mavalloc_free( ptr );
+  }
+
+  bool do_is_equal( const std::pmr::memory_resource & other ) const noexcept override
+  {
+    return dynamic_cast<const mavalloc_resource *>( &other ) != nullptr;
+  }
+};
+
+/**
+ * \brief A shared mavalloc_resource for callers that do not need their own
+ */
+inline mavalloc_resource * mavalloc_default_resource( )
+{
+  static mavalloc_resource resource;
+  return &resource;
+}
+
+/**
+ * \brief Bump allocator for memory that all dies at once
+ *
+ * Takes chunks from the arena, doubling their size each time one runs out,
+ * and carves requests off the current chunk by moving a pointer.  Deallocate
+ * does nothing; release() or the destructor returns every chunk to the arena
+ * in one go.  Meant for per-request arenas: build the request's containers
+ * on it and drop them all with the resource.
+ *
+ * Not copyable.  Each chunk costs a single ledger node however many objects
+ * it holds.
+ */
+class mavalloc_monotonic_resource : public std::pmr::memory_resource
+{
+public:
+  explicit mavalloc_monotonic_resource( std::size_t initial_size = 4096 )
+    : next_size_( initial_size < sizeof( Chunk ) * 2 ? sizeof( Chunk ) * 2 : initial_size )
+  {
+  }
+
+  mavalloc_monotonic_resource( const mavalloc_monotonic_resource & ) = delete;
+  mavalloc_monotonic_resource & operator=( const mavalloc_monotonic_resource & ) = delete;
+
+  ~mavalloc_monotonic_resource( ) override
+  {
+    release( );
+  }
+
+  /**
+   * \brief Return every chunk to the arena
+   *
+   * Everything allocated from the resource is gone afterwards.  The next
+   * allocation starts a new chunk of the size the next one would have had.
+   */
+  void release( )
+  {
+    while( chunks_ != nullptr )
+    {
+      Chunk * previous = chunks_->previous;
+      mavalloc_free( chunks_ );
+      chunks_ = previous;
+    }
+    current_ = end_ = nullptr;
+  }
+
+protected:
+  void * do_allocate( std::size_t bytes, std::size_t alignment ) override
+  {
+    std::size_t padding = ( alignment - reinterpret_cast<std::uintptr_t>( current_ ) % alignment ) % alignment;
+
+    if( current_ == nullptr || padding + bytes > static_cast<std::size_t>( end_ - current_ ) )
+    {
+      newChunk( bytes, alignment );
+      padding = ( alignment - reinterpret_cast<std::uintptr_t>( current_ ) % alignment ) % alignment;
+    }
+    void * ptr = current_ + padding;
+    current_ += padding + bytes;
+    return ptr;
+  }
+
+  void do_deallocate( void *, std::size_t, std::size_t ) override
+  {
+  }
+
+  bool do_is_equal( const std::pmr::memory_resource & other ) const noexcept override
+  {
+    return this == &other;
+  }
+
+private:
+  /** Header at the start of every chunk, the chunks form a stack */
+  struct Chunk
+  {
+    Chunk * previous;
+  };
+
+  void newChunk( std::size_t bytes, std::size_t alignment )
+  {
+    // room for the header, the worst case padding and the request
+    std::size_t needed = sizeof( Chunk ) + alignment - 1 + bytes;
+    std::size_t size = next_size_;
+
+    while( size < needed )
+    {
+      size *= 2;
+    }
+    next_size_ = size * 2;
+
+    Chunk * chunk = static_cast<Chunk *>( mavalloc_allocate_or_throw( size, alignof( std::max_align_t ) ) );
+    chunk->previous = chunks_;
+    chunks_ = chunk;
+    current_ = reinterpret_cast<unsigned char *>( chunk + 1 );
+    end_ = reinterpret_cast<unsigned char *>( chunk ) + size;
+  }
+
+  Chunk * chunks_ = nullptr;
+  unsigned char * current_ = nullptr;
+  unsigned char * end_ = nullptr;
+  std::size_t next_size_;
+};
+
+/**
+ * \brief Allocator placing a container's elements in the arena
+ *
+ * Stateless, any two instances compare equal and memory allocated through
+ * one can be released through another.
+ */
+template <class T>
+class mavalloc_allocator
+{
+public:
+  using value_type = T;
+
+  mavalloc_allocator( ) noexcept = default;
+
+  template <class U>
+  mavalloc_allocator( const mavalloc_allocator<U> & ) noexcept
+  {
+  }
+
+  T * allocate( std::size_t n )
+  {
+    if( n > std::numeric_limits<std::size_t>::max( ) / sizeof( T ) )
+    {
+      throw std::bad_array_new_length( );
+    }
+    return static_cast<T *>( mavalloc_allocate_or_throw( n == 0 ? 1 : n * sizeof( T ), alignof( T ) ) );
+  }
+
+  void deallocate( T * ptr, std::size_t ) noexcept
+  {
+    mavalloc_free( ptr );
+  }
+};
+
+template <class T, class U>
+bool operator==( const mavalloc_allocator<T> &, const mavalloc_allocator<U> & ) noexcept
+{
+  return true;
+}
+
+template <class T, class U>
+bool operator!=( const mavalloc_allocator<T> &, const mavalloc_allocator<U> & ) noexcept
+{
+  return false;
+}
+
+#endif
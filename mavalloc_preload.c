@@ -0,0 +1,431 @@
+/**
+* mavalloc_preload.c
+*
+* Drop-in malloc, free, calloc, realloc, posix_memalign and malloc_usable_size
+* backed by a mavalloc arena, so unmodified binaries can be run on mavalloc:
+*
+*   gcc -O2 -shared -fPIC -o libmavalloc.so mavalloc_preload.c mavalloc.c -ldl -lpthread
+*   LD_PRELOAD=./libmavalloc.so ./benchmark5
+*
+* The arena is created on the first call.  Its size and placement policy can be
+* set with MAVALLOC_ARENA_SIZE (bytes) and MAVALLOC_ALGORITHM (FIRST_FIT,
+* NEXT_FIT, BEST_FIT, WORST_FIT, ADAPTIVE or SEGREGATED).  Requests of at least
+* MAVALLOC_HUGE_THRESHOLD bytes, if set, are mapped on their own outside the
+* arena and realloc() grows them with mremap.
+*
+* Requests the arena can not satisfy, either because no hole is big enough or
+* because all 10,000 ledger entries are in use, fall through to the C library's
+* allocator.  free() tells the two apart with mavalloc_owns(), so the program
+* keeps running however many objects are live.
+*
+* mavalloc itself is not thread safe, every call into it is made under one lock.
+*/
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "mavalloc.h"
+
+#define DEFAULT_ARENA_SIZE  ( 256 * 1024 * 1024 )
+
+/* malloc must return memory aligned for any type.  Every block handed out of
+ * the arena is a multiple of this so they all stay aligned to the arena base.
+ */
+#define MALLOC_ALIGNMENT    16
+#define ALIGN16(s)          ( ( (s) + MALLOC_ALIGNMENT - 1 ) & ~( (size_t)MALLOC_ALIGNMENT - 1 ) )
+
+/* dlsym() may allocate before the C library's functions have been looked up.
+ * Those few requests are served from this buffer and never released.
+ */
+#define BOOTSTRAP_SIZE      ( 64 * 1024 )
+
+enum STATE
+{
+  UNINITIALIZED = 0,
+  READY,
+  FAILED
+};
+
+static void * ( *real_malloc )( size_t );
+static void   ( *real_free )( void * );
+static void * ( *real_realloc )( void *, size_t );
+static int    ( *real_posix_memalign )( void **, size_t, size_t );
+static size_t ( *real_malloc_usable_size )( void * );
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int             state = UNINITIALIZED;
+
+/* Set while this thread is inside the shim.  Any allocation made on its behalf,
+ * by dlsym() during initialization or by printf() inside mavalloc, bypasses the
+ * arena instead of deadlocking on the lock.
+ */
+static __thread int busy;
+
+static unsigned char bootstrap[BOOTSTRAP_SIZE] __attribute__(( aligned( MALLOC_ALIGNMENT ) ));
+static size_t        bootstrap_used;
+
+static int in_bootstrap( void * ptr )
+{
+  return (unsigned char *)ptr >= bootstrap && (unsigned char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/* Bootstrap blocks carry their size in the preceding header for realloc */
+static void * bootstrap_alloc( size_t size, size_t alignment )
+{
+  size_t offset = ( bootstrap_used + MALLOC_ALIGNMENT + alignment - 1 ) & ~( alignment - 1 );
+
+  if( offset + size > BOOTSTRAP_SIZE )
+  {
+    return NULL;
+  }
+  *(size_t *)( bootstrap + offset - sizeof( size_t ) ) = size;
+  bootstrap_used = offset + size;
+  return bootstrap + offset;
+}
+
+static size_t bootstrap_size( void * ptr )
+{
+  return *(size_t *)( (unsigned char *)ptr - sizeof( size_t ) );
+}
+
+static enum ALGORITHM algorithm_from_env( )
+{
+  const char * name = getenv( "MAVALLOC_ALGORITHM" );
+
+  if( name == NULL )
+  {
+    return FIRST_FIT;
+  }
+  if( strcmp( name, "NEXT_FIT" ) == 0 )
+  {
+    return NEXT_FIT;
+  }
+  if( strcmp( name, "BEST_FIT" ) == 0 )
+  {
+    return BEST_FIT;
+  }
+  if( strcmp( name, "ADAPTIVE" ) == 0 )
+  {
+    return ADAPTIVE;
+  }
+  if( strcmp( name, "WORST_FIT" ) == 0 )
+  {
+    return WORST_FIT;
+  }
+  if( strcmp( name, "SEGREGATED" ) == 0 )
+  {
+    return SEGREGATED;
+  }
+  return FIRST_FIT;
+}
+
+/* fork() may be called while another thread holds the lock.  It is taken
+ * around the fork so the arena is copied in a consistent state, and the child,
+ * where only the forking thread survives, starts with a fresh lock.
+ */
+static void fork_prepare( )
+{
+  pthread_mutex_lock( &lock );
+}
+
+static void fork_parent( )
+{
+  pthread_mutex_unlock( &lock );
+}
+
+static void fork_child( )
+{
+  pthread_mutex_init( &lock, NULL );
+}
+
+static void initialize( )
+{
+  const char * size_env = getenv( "MAVALLOC_ARENA_SIZE" );
+  size_t       size = DEFAULT_ARENA_SIZE;
+
+  real_malloc = dlsym( RTLD_NEXT, "malloc" );
+  real_free = dlsym( RTLD_NEXT, "free" );
+  real_realloc = dlsym( RTLD_NEXT, "realloc" );
+  real_posix_memalign = dlsym( RTLD_NEXT, "posix_memalign" );
+  real_malloc_usable_size = dlsym( RTLD_NEXT, "malloc_usable_size" );
+  pthread_atfork( fork_prepare, fork_parent, fork_child );
+
+  if( size_env != NULL && strtoull( size_env, NULL, 0 ) > 0 )
+  {
+    size = strtoull( size_env, NULL, 0 );
+  }
+
+  /* mavalloc_init calls malloc for the arena, which lands in real_malloc
+   * because busy is set.
+   */
+  if( real_malloc && real_free && mavalloc_init( ALIGN16( size ), algorithm_from_env( ) ) == 0 )
+  {
+    const char * huge_env = getenv( "MAVALLOC_HUGE_THRESHOLD" );
+
+    if( huge_env != NULL )
+    {
+      mavalloc_set_huge_threshold( strtoull( huge_env, NULL, 0 ) );
+    }
+    __atomic_store_n( &state, READY, __ATOMIC_RELEASE );
+  }
+  else
+  {
+    __atomic_store_n( &state, FAILED, __ATOMIC_RELEASE );
+  }
+}
+
+/* Returns 1 when the arena is usable.  Must be called with busy clear. */
+static int ensure_initialized( )
+{
+  int current = __atomic_load_n( &state, __ATOMIC_ACQUIRE );
+
+  if( current == UNINITIALIZED )
+  {
+    busy = 1;
+    pthread_mutex_lock( &lock );
+    if( state == UNINITIALIZED )
+    {
+      initialize( );
+    }
+    pthread_mutex_unlock( &lock );
+    busy = 0;
+    current = __atomic_load_n( &state, __ATOMIC_ACQUIRE );
+  }
+  return current == READY;
+}
+
+/* Huge blocks live outside the arena, in a table another thread may be
+ * changing.  They are page aligned, so only page aligned pointers need the
+ * lock to be looked up.
+ */
+static int owned( void * ptr )
+{
+  int result;
+
+  if( ( (uintptr_t)ptr & 4095 ) != 0 || busy )
+  {
+    return mavalloc_owns( ptr );
+  }
+
+  busy = 1;
+  pthread_mutex_lock( &lock );
+  result = mavalloc_owns( ptr );
+  pthread_mutex_unlock( &lock );
+  busy = 0;
+  return result;
+}
+
+static void * fallback_malloc( size_t size )
+{
+  if( real_malloc )
+  {
+    return real_malloc( size );
+  }
+  return bootstrap_alloc( size, MALLOC_ALIGNMENT );
+}
+
+/* calloc, realloc and posix_memalign go through here rather than malloc() so
+ * the compiler can not fold malloc plus memset back into a call to calloc.
+ */
+static void * arena_malloc( size_t size )
+{
+  void * ptr = NULL;
+
+  if( busy || !ensure_initialized( ) )
+  {
+    return fallback_malloc( size );
+  }
+
+  busy = 1;
+  pthread_mutex_lock( &lock );
+  ptr = mavalloc_alloc( ALIGN16( size ? size : 1 ) );
+  pthread_mutex_unlock( &lock );
+  busy = 0;
+
+  if( ptr == NULL )
+  {
+    ptr = fallback_malloc( size );
+  }
+  return ptr;
+}
+
+void * malloc( size_t size )
+{
+  return arena_malloc( size );
+}
+
+void free( void * ptr )
+{
+  if( ptr == NULL || in_bootstrap( ptr ) )
+  {
+    return;
+  }
+
+  if( owned( ptr ) )
+  {
+    int nested = busy;
+    busy = 1;
+    if( !nested )
+    {
+      pthread_mutex_lock( &lock );
+    }
+    mavalloc_free( ptr );
+    if( !nested )
+    {
+      pthread_mutex_unlock( &lock );
+    }
+    busy = nested;
+    return;
+  }
+
+  if( !busy )
+  {
+    ensure_initialized( );
+  }
+  if( real_free )
+  {
+    real_free( ptr );
+  }
+}
+
+void * calloc( size_t count, size_t size )
+{
+  void * ptr;
+
+  if( size && count > SIZE_MAX / size )
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  ptr = arena_malloc( count * size );
+  if( ptr )
+  {
+    memset( ptr, 0, count * size );
+  }
+  return ptr;
+}
+
+size_t malloc_usable_size( void * ptr )
+{
+  size_t size;
+
+  if( ptr == NULL )
+  {
+    return 0;
+  }
+  if( in_bootstrap( ptr ) )
+  {
+    return bootstrap_size( ptr );
+  }
+  if( owned( ptr ) )
+  {
+    busy = 1;
+    pthread_mutex_lock( &lock );
+    size = mavalloc_usable_size( ptr );
+    pthread_mutex_unlock( &lock );
+    busy = 0;
+    return size;
+  }
+  if( !busy )
+  {
+    ensure_initialized( );
+  }
+  return real_malloc_usable_size ? real_malloc_usable_size( ptr ) : 0;
+}
+
+void * realloc( void * ptr, size_t size )
+{
+  void * new_ptr;
+  size_t old_size;
+
+  if( ptr == NULL )
+  {
+    return arena_malloc( size );
+  }
+  if( size == 0 )
+  {
+    free( ptr );
+    return NULL;
+  }
+
+  if( !in_bootstrap( ptr ) && !owned( ptr ) )
+  {
+    if( !busy )
+    {
+      ensure_initialized( );
+    }
+    return real_realloc ? real_realloc( ptr, size ) : NULL;
+  }
+
+  old_size = malloc_usable_size( ptr );
+  if( size <= old_size )
+  {
+    return ptr;
+  }
+
+  /* mavalloc remaps huge blocks rather than copying them */
+  if( !in_bootstrap( ptr ) && !busy )
+  {
+    busy = 1;
+    pthread_mutex_lock( &lock );
+    new_ptr = mavalloc_realloc( ptr, ALIGN16( size ) );
+    pthread_mutex_unlock( &lock );
+    busy = 0;
+    if( new_ptr != NULL )
+    {
+      return new_ptr;
+    }
+  }
+
+  new_ptr = arena_malloc( size );
+  if( new_ptr == NULL )
+  {
+    return NULL;
+  }
+  memcpy( new_ptr, ptr, old_size );
+  free( ptr );
+  return new_ptr;
+}
+
+int posix_memalign( void ** memptr, size_t alignment, size_t size )
+{
+  void * ptr;
+
+  if( alignment < sizeof( void * ) || ( alignment & ( alignment - 1 ) ) != 0 )
+  {
+    return EINVAL;
+  }
+
+  /* The arena only guarantees MALLOC_ALIGNMENT, stricter requests go to the
+   * C library, whether or not the arena could be set up.  Only a request made
+   * before dlsym() has found it, with the initializing thread holding the
+   * lock, is served from the bootstrap buffer.
+   */
+  if( alignment <= MALLOC_ALIGNMENT )
+  {
+    ptr = arena_malloc( size );
+  }
+  else
+  {
+    if( !busy )
+    {
+      ensure_initialized( );
+    }
+    if( real_posix_memalign )
+    {
+      return real_posix_memalign( memptr, alignment, size );
+    }
+    ptr = bootstrap_alloc( size, alignment );
+  }
+
+  if( ptr == NULL )
+  {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}